@@ -0,0 +1,100 @@
+#include "AllocationProfile.h"
+
+#ifdef ALLOC_PROFILE
+#include <atomic>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+
+// in front of every block: the requested size, padded so the caller keeps malloc's alignment
+#define HEADER_SIZE 16
+
+struct AllocationCounter{
+    atomic<long long> allocations;
+    atomic<long long> bytes;
+    atomic<long long> frees;
+    atomic<long long> freed_bytes;
+};
+
+// zero initialized before any constructor runs, so allocations of static initializers are counted too
+static AllocationCounter counters[PHASE_COUNT + 1][ALLOC_CATEGORY_COUNT];
+static atomic<long long> live_bytes(0);
+static atomic<long long> peak_bytes(0);
+
+thread_local int AllocationProfile::phase = PHASE_COUNT;
+thread_local int AllocationProfile::category = ALLOC_OTHER;
+
+static int registered = atexit(AllocationProfile::report);
+
+const char* AllocationProfile::categoryName(int category){
+    switch(category){
+        case ALLOC_OTHER: return "other";
+        case ALLOC_LEX: return "lex";
+        case ALLOC_INSTRUCTION: return "instruction";
+        case ALLOC_DIRECTIVE: return "directive";
+        case ALLOC_SYMBOL: return "symbol";
+        case ALLOC_OPERAND: return "operand";
+        case ALLOC_RELOCATION: return "relocation";
+        case ALLOC_MACRO: return "macro";
+        case ALLOC_OUTPUT: return "output";
+        default: return "unknown";
+    }
+}
+
+void AllocationProfile::report(){
+    (void)registered;
+    long long total[4] = {0, 0, 0, 0};
+    fprintf(stderr, "phase        category     allocations        bytes        frees  freed bytes\n");
+    for(int p = 0; p <= PHASE_COUNT; p++){
+        for(int c = 0; c < ALLOC_CATEGORY_COUNT; c++){
+            AllocationCounter& counter = counters[p][c];
+            long long row[4] = {counter.allocations.load(), counter.bytes.load(), counter.frees.load(), counter.freed_bytes.load()};
+            if(row[0] == 0 && row[2] == 0) continue;
+            fprintf(stderr, "%-12s %-12s %11lld %12lld %12lld %12lld\n", p == PHASE_COUNT ? "none" : Statistics::phaseName((Phase)p), categoryName(c), row[0], row[1], row[2], row[3]);
+            for(int i = 0; i < 4; i++) total[i] += row[i];
+        }
+    }
+    fprintf(stderr, "%-25s %11lld %12lld %12lld %12lld\n", "total", total[0], total[1], total[2], total[3]);
+    fprintf(stderr, "peak live bytes: %lld\n", peak_bytes.load());
+}
+
+static void* allocate(size_t size){
+    char* block = (char*)malloc(size + HEADER_SIZE);
+    if(block == nullptr) throw bad_alloc();
+    *(size_t*)block = size;
+    AllocationCounter& counter = counters[AllocationProfile::phase][AllocationProfile::category];
+    counter.allocations.fetch_add(1, memory_order_relaxed);
+    counter.bytes.fetch_add(size, memory_order_relaxed);
+    long long live = live_bytes.fetch_add(size, memory_order_relaxed) + size;
+    long long peak = peak_bytes.load(memory_order_relaxed);
+    while(live > peak && !peak_bytes.compare_exchange_weak(peak, live, memory_order_relaxed));
+    return block + HEADER_SIZE;
+}
+
+static void release(void* pointer){
+    if(pointer == nullptr) return;
+    char* block = (char*)pointer - HEADER_SIZE;
+    size_t size = *(size_t*)block;
+    AllocationCounter& counter = counters[AllocationProfile::phase][AllocationProfile::category];
+    counter.frees.fetch_add(1, memory_order_relaxed);
+    counter.freed_bytes.fetch_add(size, memory_order_relaxed);
+    live_bytes.fetch_sub(size, memory_order_relaxed);
+    free(block);
+}
+
+void* operator new(size_t size){ return allocate(size); }
+void* operator new[](size_t size){ return allocate(size); }
+void* operator new(size_t size, const nothrow_t&) noexcept {
+    try{ return allocate(size); } catch(...){ return nullptr; }
+}
+void* operator new[](size_t size, const nothrow_t&) noexcept {
+    try{ return allocate(size); } catch(...){ return nullptr; }
+}
+void operator delete(void* pointer) noexcept { release(pointer); }
+void operator delete[](void* pointer) noexcept { release(pointer); }
+void operator delete(void* pointer, size_t) noexcept { release(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { release(pointer); }
+void operator delete(void* pointer, const nothrow_t&) noexcept { release(pointer); }
+void operator delete[](void* pointer, const nothrow_t&) noexcept { release(pointer); }
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef ALLOCATIONPROFILE_H
+#define ALLOCATIONPROFILE_H
+
+#include "INCLUDES.h"
+#include "Statistics.h"
+
+enum AllocationCategory{
+    ALLOC_OTHER,
+    ALLOC_LEX, // processOneLine, lexLine
+    ALLOC_INSTRUCTION, // dealWithInstruction
+    ALLOC_DIRECTIVE, // dealWithDirective
+    ALLOC_SYMBOL, // defineSymbol, dealWithSymbol, isSymbol
+    ALLOC_OPERAND, // getInt, getAdressingMode
+    ALLOC_RELOCATION, // dealWithRelocationRecord
+    ALLOC_MACRO, // recording and expanding .macro/.rept
+    ALLOC_OUTPUT, // end(), formatSection
+    ALLOC_CATEGORY_COUNT
+};
+
+/*
+    Heap profile of one run, compiled in with -DALLOC_PROFILE. The global
+    operator new and delete are replaced by versions that count allocations,
+    bytes and frees per phase (set by PhaseTimer, whether or not --stats is
+    given) and per category (set by ALLOC_SCOPE at the top of the functions
+    that allocate most), and the table is printed to stderr at exit.
+
+    Scopes nest, the innermost one counts. Temporaries for by value arguments
+    are made before the callee's scope starts, so they count for the caller.
+    Without -DALLOC_PROFILE nothing is replaced and ALLOC_SCOPE expands to
+    nothing.
+*/
+#ifdef ALLOC_PROFILE
+class AllocationProfile{
+    public:
+        static thread_local int phase; // PHASE_COUNT outside of all phases
+        static thread_local int category;
+
+        static const char* categoryName(int category);
+        static void report(); // writes the table to stderr, registered with atexit
+};
+
+class AllocationScope{
+    private:
+        int previous;
+    public:
+        AllocationScope(AllocationCategory category):previous(AllocationProfile::category){
+            AllocationProfile::category = category;
+        }
+        ~AllocationScope(){
+            AllocationProfile::category = previous;
+        }
+};
+
+#define ALLOC_SCOPE(category) AllocationScope alloc_scope(category)
+#else
+#define ALLOC_SCOPE(category)
+#endif
+
+#endif
@@ -0,0 +1,202 @@
+#include "Archive.h"
+#include "ObjectFile.h"
+#include <sstream>
+#include <iterator>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+Archive::Archive(){
+    data = nullptr;
+    size = 0;
+    header = nullptr;
+    members = nullptr;
+    slots = nullptr;
+}
+
+Archive::~Archive(){
+    if(data != nullptr) munmap((void*)data, size);
+}
+
+// FNV-1a, same function on write and lookup
+unsigned int Archive::hash(const char* name, size_t length){
+    unsigned int h = 0x811c9dc5;
+    for(size_t i = 0; i < length; i++) h = (h ^ (unsigned char)name[i]) * 0x01000193;
+    return h;
+}
+
+bool Archive::isArchive(string file_name){
+    ifstream file(file_name, ios::in | ios::binary);
+    char magic[4];
+    if(file.is_open()==false || !file.read(magic, 4)) return false;
+    return memcmp(magic, ARCHIVE_MAGIC, 4) == 0;
+}
+
+bool Archive::open(string file_name){
+    int fd = ::open(file_name.c_str(), O_RDONLY);
+    if(fd < 0){
+        error = "File " + file_name + " cannot be opened";
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ArchiveHeader)){
+        close(fd);
+        error = file_name + " is not an archive.";
+        return false;
+    }
+    size = st.st_size;
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(mapped == MAP_FAILED){
+        error = "File " + file_name + " cannot be mapped";
+        return false;
+    }
+    data = (const char*)mapped;
+    header = (const ArchiveHeader*)data;
+    members = (const ArchiveMember*)(data + sizeof(ArchiveHeader));
+    slots = (const ArchiveSlot*)(members + header->member_count);
+    if(memcmp(header->magic, ARCHIVE_MAGIC, 4) != 0 || header->version != ARCHIVE_VERSION
+        || (const char*)(slots + header->slot_count) > data + size || (header->slot_count & (header->slot_count - 1)) != 0){
+        error = file_name + " is not an archive or was written by another version.";
+        return false;
+    }
+    for(unsigned int i = 0; i < header->member_count; i++){
+        if((unsigned long long)members[i].data_offset + members[i].data_length > size || (unsigned long long)members[i].name_offset + members[i].name_length > size){
+            error = file_name + " is truncated.";
+            return false;
+        }
+    }
+    return true;
+}
+
+int Archive::findSymbol(const string& name){
+    if(header->slot_count == 0) return -1;
+    unsigned int h = hash(name.data(), name.size());
+    unsigned int mask = header->slot_count - 1;
+    for(unsigned int i = h & mask; slots[i].name_length != 0; i = (i + 1) & mask){
+        const ArchiveSlot& slot = slots[i];
+        if(slot.hash == h && slot.name_length == name.size() && memcmp(data + slot.name_offset, name.data(), name.size()) == 0) return slot.member;
+    }
+    return -1;
+}
+
+unsigned int Archive::memberCount(){
+    return header->member_count;
+}
+
+string Archive::memberName(unsigned int member){
+    return string(data + members[member].name_offset, members[member].name_length);
+}
+
+const char* Archive::memberData(unsigned int member, size_t& length){
+    length = members[member].data_length;
+    return data + members[member].data_offset;
+}
+
+static void append32(string& out, unsigned int value){
+    for(int i = 0; i < 4; i++) out += (char)((value >> (8*i)) & 0xFF);
+}
+
+bool Archive::write(string file_name, vector<string> object_files, string& error){
+    vector<string> names = {};
+    vector<string> contents = {};
+    vector<pair<string, unsigned int>> symbols = {}; // global -> member
+    unordered_map<string, unsigned int> defined = {};
+    for(unsigned int i = 0; i < object_files.size(); i++){
+        ifstream file(object_files[i], ios::in | ios::binary);
+        if(file.is_open()==false){
+            error = "File " + object_files[i] + " cannot be opened";
+            return false;
+        }
+        contents.push_back(string(istreambuf_iterator<char>(file), istreambuf_iterator<char>()));
+        ObjectFile object;
+        if(!object.readBuffer(contents[i].data(), contents[i].size())){
+            error = object_files[i] + ": " + object.error;
+            return false;
+        }
+        size_t slash = object_files[i].find_last_of('/');
+        names.push_back(slash == string::npos ? object_files[i] : object_files[i].substr(slash + 1));
+        for(SymbolTableEntry& ste: object.st->table){
+            if(ste.local || ste.section == "UND") continue;
+            if(defined.find(ste.name) != defined.end()){
+                error = "Symbol " + ste.name + " is defined in " + names[defined[ste.name]] + " and in " + names[i] + ".";
+                return false;
+            }
+            defined.emplace(ste.name, i);
+            symbols.push_back(make_pair(ste.name, i));
+        }
+    }
+
+    // at most half full, keeps probe sequences short
+    unsigned int slot_count = 1;
+    while(slot_count < symbols.size() * 2) slot_count <<= 1;
+    if(symbols.size() == 0) slot_count = 0;
+    size_t strings_offset = sizeof(ArchiveHeader) + names.size() * sizeof(ArchiveMember) + slot_count * sizeof(ArchiveSlot);
+    string strings = "";
+    vector<ArchiveMember> member_table(names.size());
+    vector<ArchiveSlot> slot_table(slot_count, ArchiveSlot{0, 0, 0, 0});
+    for(unsigned int i = 0; i < names.size(); i++){
+        member_table[i].name_offset = strings_offset + strings.size();
+        member_table[i].name_length = names[i].size();
+        strings += names[i];
+    }
+    for(pair<string, unsigned int>& symbol: symbols){
+        unsigned int h = hash(symbol.first.data(), symbol.first.size());
+        unsigned int i = h & (slot_count - 1);
+        while(slot_table[i].name_length != 0) i = (i + 1) & (slot_count - 1);
+        slot_table[i] = ArchiveSlot{h, (unsigned int)(strings_offset + strings.size()), (unsigned int)symbol.first.size(), symbol.second};
+        strings += symbol.first;
+    }
+    size_t data_offset = strings_offset + strings.size();
+    for(unsigned int i = 0; i < names.size(); i++){
+        member_table[i].data_offset = data_offset;
+        member_table[i].data_length = contents[i].size();
+        data_offset += contents[i].size();
+    }
+    if(data_offset > 0xFFFFFFFFULL){
+        error = "Archive would be larger than 4G.";
+        return false;
+    }
+
+    string out = ARCHIVE_MAGIC;
+    append32(out, ARCHIVE_VERSION);
+    append32(out, names.size());
+    append32(out, slot_count);
+    for(ArchiveMember& member: member_table){
+        append32(out, member.name_offset);
+        append32(out, member.name_length);
+        append32(out, member.data_offset);
+        append32(out, member.data_length);
+    }
+    for(ArchiveSlot& slot: slot_table){
+        append32(out, slot.hash);
+        append32(out, slot.name_offset);
+        append32(out, slot.name_length);
+        append32(out, slot.member);
+    }
+    out += strings;
+    for(string& content: contents) out += content;
+
+    ofstream file(file_name, ios::out | ios::binary | ios::trunc);
+    if(file.is_open()==false || !file.write(out.data(), out.size())){
+        error = "File " + file_name + " cannot be written";
+        return false;
+    }
+    return true;
+}
+
+string Archive::toString(){
+    stringstream ss;
+    ss<<"#MEMBERS: "<<header->member_count<<endl;
+    for(unsigned int i = 0; i < header->member_count; i++){
+        ss<<memberName(i)<<" "<<members[i].data_length<<endl;
+    }
+    ss<<"#INDEX: "<<endl;
+    for(unsigned int i = 0; i < header->slot_count; i++){
+        if(slots[i].name_length == 0) continue;
+        ss<<string(data + slots[i].name_offset, slots[i].name_length)<<" "<<memberName(slots[i].member)<<endl;
+    }
+    return ss.str();
+}
@@ -0,0 +1,72 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include "INCLUDES.h"
+#include <vector>
+
+#define ARCHIVE_MAGIC "BGAR"
+#define ARCHIVE_VERSION 1
+
+/*
+    Archive of object files with a global symbol index built once, when the
+    archive is written. Layout, all numbers little endian 32 bit:
+
+        header  magic, version, member count, slot count
+        members name offset, name length, data offset, data length
+        slots   hash, name offset, name length, member, empty slots have length 0
+        strings member and symbol names
+        data    member objects, unchanged text written by Assembler::end()
+
+    The index is an open addressing hash table with a power of two slot count,
+    so a lookup hashes the name once and usually touches a single slot. The
+    file is mapped, opening an archive reads nothing but the header and a
+    member is only parsed when a symbol from it is needed.
+*/
+struct ArchiveHeader{
+    char magic[4];
+    unsigned int version;
+    unsigned int member_count;
+    unsigned int slot_count;
+};
+
+struct ArchiveMember{
+    unsigned int name_offset;
+    unsigned int name_length;
+    unsigned int data_offset;
+    unsigned int data_length;
+};
+
+struct ArchiveSlot{
+    unsigned int hash;
+    unsigned int name_offset;
+    unsigned int name_length;
+    unsigned int member;
+};
+
+class Archive{
+    private:
+        const char* data; // mapped file
+        size_t size;
+        const ArchiveHeader* header;
+        const ArchiveMember* members;
+        const ArchiveSlot* slots;
+
+        static unsigned int hash(const char* name, size_t length);
+    public:
+        string error; // reason the last open or write failed
+
+        Archive();
+        ~Archive();
+
+        bool open(string file_name); // maps the archive and checks the header
+        int findSymbol(const string& name); // member that defines a global, -1 if none does
+        unsigned int memberCount();
+        string memberName(unsigned int member);
+        const char* memberData(unsigned int member, size_t& length); // points into the mapping
+
+        static bool isArchive(string file_name); // checks the magic
+        static bool write(string file_name, vector<string> object_files, string& error); // globals defined twice are an error
+        string toString(); // members and the index, for listing
+};
+
+#endif
@@ -1,34 +1,41 @@
 #include "Assembler.h"
 #include "INCLUDES.h"
+#include "Jobserver.h"
+#include "AllocationProfile.h"
 #include <algorithm>
 #include <map>
+#include <unordered_map>
 #include <math.h>
 #include <sstream>
+#include <thread>
+#include <atomic>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 string addSpaceAfterComma(string x){
     string ret="";
+    ret.reserve(x.length() + x.length()/2);
     for(int i=0;i<x.length();i++)
     {
-        if(x[i]!=',')
-        ret=ret+x[i];
-        else
-        ret=ret+x[i]+" ";
+        ret += x[i];
+        if(x[i]==',') ret += ' ';
     }
     return ret;
 }
 
 Assembler::Assembler(string ifn, string ofn){
-    input_file_name = ifn;
-    output_file_name = ofn;
-
-    line_of_code = 0;
+    recording = nullptr;
+    stats = nullptr;
+    prelude_file = "";
+    emit_prelude = false;
+    line_table = false;
 
     st = new SymbolTable();
     fm = new FileManager();
     tm = new TextManipulator();
-    current_section = new Section("UND"); // default "empty" section for globals without definition or externs
-    st->addSymbol(*(new SymbolTableEntry("", "UND", 0, true)));
-    st->addSymbol(*(new SymbolTableEntry("ABS", "ABS", 0, true, true)));
+    undefined_section = new Section("UND"); // default "empty" section for globals without definition or externs
     
     sections = {};
 
@@ -61,70 +68,276 @@ Assembler::Assembler(string ifn, string ofn){
     };
 
     directive_map = createMap();
+    reset(ifn, ofn);
+}
+
+void Assembler::reset(string ifn, string ofn){
+    input_file_name = ifn;
+    output_file_name = ofn;
+
+    line_of_code = 0;
+    finished = false;
+    delete recording; // left open by a run without .end
+    recording = nullptr;
+    recording_depth = 0;
+    rept_count = -1;
+    macro_counter = 0;
+    skipped_depth = 0;
+    assembly_code.clear();
+    ust.clear();
+    macros.clear();
+    expansion_stack.clear();
+    include_stack.clear();
+    conditionals.clear();
+    source_lines.clear();
+
+    // sections wait for a section of the same name in the next run, similar inputs get buffers of the right size
+    for(Section* section: sections){
+        section->clear();
+        if(!spare_sections.emplace(section->name, section).second) delete section;
+    }
+    sections.clear();
+    section_index.clear();
+    undefined_section->clear();
+    current_section = undefined_section;
+
+    st->clear();
+    SymbolTableEntry::global_id = 0; // ids start over, so every run writes the same object a new process would
+    st->addSymbol(SymbolTableEntry("", "UND", 0, true));
+    st->addSymbol(SymbolTableEntry("ABS", "ABS", 0, true, true));
 }
 
 int Assembler::start(){
-    assembly_code = fm->getContent(input_file_name);
-    for(string line: assembly_code){
-        
-        vector<char> processedLine = processOneLine(line);
-        //machine_code.push_back(processedLine);
-        if(processedLine.size() == 0) continue;
-        current_section->getMachineCode().insert(current_section->machine_code.end(), processedLine.begin(), processedLine.end());
+    TraceScope trace("Assembler::start", "input", input_file_name);
+    if(prelude_file != ""){
+        PhaseTimer timer(stats, PHASE_READ);
+        TraceScope trace_prelude("Assembler::loadPrelude");
+        loadPrelude();
+    }
+    {
+        PhaseTimer timer(stats, PHASE_READ);
+        TraceScope trace_read("FileManager::getContent");
+        assembly_code = fm->getContent(input_file_name);
+    }
+    {
+        PhaseTimer timer(stats, PHASE_PROCESS);
+        TraceScope trace_process("process");
+        long long chunk_start = Tracer::enabled() ? Tracer::active->now() : 0;
+        for(string& line: assembly_code){
+            if(Tracer::enabled() && line_of_code % TRACE_CHUNK_LINES == 0 && line_of_code > 0){
+                Tracer::active->complete("lines", chunk_start, "\"first\":" + to_string(line_of_code-TRACE_CHUNK_LINES+1) + ",\"last\":" + to_string(line_of_code));
+                chunk_start = Tracer::active->now();
+            }
+            
+            Section* section = current_section;
+            int address = section->location_counter;
+            int first_id = SymbolTableEntry::global_id;
+            vector<char> processedLine = processOneLine(line);
+            source_lines.push_back(SourceLine(processedLine.size() > 0 && current_section == section ? section : nullptr, address, processedLine.size(), first_id));
+            if(finished) break; // .end directive, rest of the file is ignored
+            // macro expansions count for the line of the call
+            if(line_table && current_section == section && section->location_counter > address) section->addLine(address, line_of_code);
+            //machine_code.push_back(processedLine);
+            if(processedLine.size() == 0) continue;
+            current_section->getMachineCode().insert(current_section->machine_code.end(), processedLine.begin(), processedLine.end());
+        }
+        if(Tracer::enabled() && line_of_code % TRACE_CHUNK_LINES != 0){
+            Tracer::active->complete("lines", chunk_start, "\"first\":" + to_string(line_of_code/TRACE_CHUNK_LINES*TRACE_CHUNK_LINES+1) + ",\"last\":" + to_string(line_of_code));
+        }
     }
+    if(stats != nullptr) stats->lines = line_of_code;
+    if(recording != nullptr) handleError("Missing " + string(rept_count < 0 ? ".endm" : ".endr") + " for the definition on line:" + to_string(recording->line) + ".");
+    if(!conditionals.empty()) handleError("Missing .endif for the .if on line:" + to_string(conditionals.back().line) + ".");
+    if(!finished) return -1; // no .end, nothing is written
+    end();
     return 0;
 }
 
+bool Assembler::patch(){
+    TraceScope trace("Assembler::patch", "input", input_file_name);
+    if(!finished || emit_prelude) return false;
+    vector<string> code = fm->getContent(input_file_name);
+    if(code.size() != assembly_code.size()) return false; // added or removed lines renumber everything after them
+    size_t symbols = st->table.size();
+    vector<Section*> changed = {};
+    for(size_t i = 0; i < code.size() && i < source_lines.size(); i++){ // lines after .end don't matter
+        if(code[i] == assembly_code[i]) continue;
+        // an instruction can only become another instruction, labels, directives and macros can define symbols or move code
+        SourceLine& source = source_lines[i];
+        if(source.section == nullptr) return false;
+        vector<string> old_tokens = lexLine(assembly_code[i]);
+        vector<string> tokens = lexLine(code[i]);
+        if(tokens.size() == 0 || tokens[0][0] == '.' || macros.count(tokens[0]) > 0) return false;
+        // the symbol table stays the same only if neither line holds the first mention of a symbol, expressions fold differently before a symbol is defined
+        if(!mentionsOnlyEarlier(old_tokens, source.first_id) || !mentionsOnlyEarlier(tokens, source.first_id)) return false;
+
+        Section* section = source.section;
+        vector<RelocationTableEntry>& relocations = section->relocation_table;
+        size_t kept = relocations.size();
+        int location_counter = section->location_counter;
+        current_section = section;
+        section->location_counter = source.offset;
+        line_of_code = i + 1;
+        vector<char> line = dealWithInstruction(tokens);
+        current_section = nullptr;
+        section->location_counter = location_counter;
+        if(line.size() != (size_t)source.length || st->table.size() != symbols) return false;
+        copy(line.begin(), line.end(), section->machine_code.begin() + source.offset);
+
+        // relocations of the line take the place of the old ones, the table is in field order
+        vector<RelocationTableEntry> added(relocations.begin() + kept, relocations.end());
+        relocations.erase(relocations.begin() + kept, relocations.end());
+        vector<RelocationTableEntry>::iterator first = find_if(relocations.begin(), relocations.end(), [&](const RelocationTableEntry& rte){ return rte.offset >= source.offset; });
+        vector<RelocationTableEntry>::iterator last = find_if(first, relocations.end(), [&](const RelocationTableEntry& rte){ return rte.offset >= source.offset + source.length; });
+        first = relocations.erase(first, last);
+        for(RelocationTableEntry& rte: added){
+            if(finalizeRelocation(rte, section)) first = relocations.insert(first, rte) + 1;
+        }
+        if(find(changed.begin(), changed.end(), section) == changed.end()) changed.push_back(section);
+    }
+    assembly_code = code;
+    for(size_t i = 0; i < sections.size(); i++){
+        if(find(changed.begin(), changed.end(), sections[i]) == changed.end()) continue;
+        relocation_texts[i] = sections[i]->getRelocationTable();
+        machine_code_texts[i] = sections[i]->getMachineCodeString();
+    }
+    writeObject();
+    return true;
+}
+
+bool Assembler::mentionsOnlyEarlier(const vector<string>& tokens, int first_id){
+    if(tokens.size() == 0 || tokens[0].find(':') != string::npos) return false; // a label is defined here
+    for(size_t i = 1; i < tokens.size(); i++){
+        const string& operand = tokens[i];
+        size_t begin = (operand[0] == '$' || operand[0] == '*') ? 1 : 0;
+        size_t end = operand.find('(');
+        if(end == string::npos) end = operand.size();
+        if(begin == end || operand[begin] == '%') continue;
+        for(size_t j = begin; j < end; j++){
+            if(!isalnum(operand[j]) && operand[j] != '_' && operand[j] != '.') return false;
+        }
+        if(isdigit(operand[begin])) continue;
+        SymbolTableEntry* ste = st->findSymbol(operand.substr(begin, end - begin));
+        if(ste == nullptr || ste->id >= first_id) return false;
+    }
+    return true;
+}
+
+void Assembler::setStatistics(Statistics* stats){
+    this->stats = stats;
+}
+
+void Assembler::setPrelude(string snapshot_file){
+    prelude_file = snapshot_file;
+}
+
+void Assembler::setEmitPrelude(bool emit){
+    emit_prelude = emit;
+}
+
+void Assembler::setLineTable(bool enabled){
+    line_table = enabled;
+}
+
+void Assembler::loadPrelude(){
+    int fd = open(prelude_file.c_str(), O_RDONLY);
+    struct stat info;
+    if(fd < 0 || fstat(fd, &info) != 0){
+        cerr<<"Prelude "<<prelude_file<<" cannot be opened"<<endl;
+        exit(1);
+    }
+    void* mapped = info.st_size > 0 ? mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if(mapped == MAP_FAILED || !st->loadSnapshot((const char*)mapped, info.st_size)){
+        cerr<<prelude_file<<" is not a prelude snapshot of this assembler version"<<endl;
+        exit(1);
+    }
+    munmap(mapped, info.st_size);
+}
+
 vector<char> Assembler::processOneLine(string line){
+    ALLOC_SCOPE(ALLOC_LEX);
     line_of_code += 1;
+    if(skipping()){ // inactive .if branch, never lexed
+        skipLine(line);
+        return {};
+    }
     // Line recognition - section/instruction/label
     if(tm->isEmpty(line)) return {};
     if(line[0] == '#') { // full line comments functionality
         dealWithComment(line);
         return {};
     }
+    vector<string> tokens = lexLine(line);
+    if(tokens.size() == 0) return {};
+    if(recording != nullptr){ // inside .macro or .rept body
+        recordLine(tokens);
+        return {};
+    }
+    return processTokens(tokens);
+}
+
+vector<string> Assembler::lexLine(string line){
+    ALLOC_SCOPE(ALLOC_LEX);
     if(line.find(':')!= string::npos) line.replace(line.find(':')+1, 1, line[line.find(':')+1]=='.' ? " ." : " ");
-    vector<string> to_process = tm->extractWords(addSpaceAfterComma(line));
-    bool lab = false;
-    if(to_process[0].find(':') != string::npos) {
+    vector<string> tokens = tm->extractWords(addSpaceAfterComma(line));
+    // everything from the first word with # on is a comment, label is never cut
+    for(size_t i = 0; i < tokens.size(); i++){
+        if(i == 0 && tokens[0].find(':') != string::npos) continue;
+        if(tokens[i].find('#') != string::npos){
+            dealWithComment(line.substr(line.find('#')));
+            tokens.resize(i);
+            break;
+        }
+    }
+    return tokens;
+}
+
+vector<char> Assembler::processTokens(vector<string>& tokens){
+    if(skipping()){ // macro body line in an inactive .if branch
+        const string& directive = tokens[0].find(':') != string::npos ? (tokens.size() > 1 ? tokens[1] : tokens[0]) : tokens[0];
+        if(directive[0] == '.') skipDirective(directive.c_str() + 1, directive.size() - 1);
+        return {};
+    }
+    if(tokens[0].find(':') != string::npos) {
         if(current_section->name == "UND") handleError("Can't have label outside of a section.");
-        defineSymbol(to_process[0].substr(0, to_process[0].length()-1), true, true);
-        lab = true;
-    }
-    bool inst = true;
-    string instruction = "";
-    string comment = "";
-    for(string n: to_process){
-        if(lab){
-            lab = false;
-            continue;
-        } 
-        if(n.find('#') != string::npos) inst = false;
-        if(inst) instruction = instruction + n + " ";
-        else comment = comment + n + " ";
+        defineSymbol(tokens[0].substr(0, tokens[0].length()-1), true, true);
+        tokens.erase(tokens.begin());
+        if(tokens.size() == 0) return {};
     }
-    if(instruction != "") return dealWithInstruction(instruction);
-    if(comment != "") dealWithComment(comment);
-    return {};
+    return dealWithInstruction(tokens);
 }
 
-vector<char> Assembler::dealWithInstruction(string instruction){
-    if(instruction[0] == '.'){
-        dealWithDirective(instruction.substr(1));
+vector<char> Assembler::dealWithInstruction(vector<string>& words){
+    ALLOC_SCOPE(ALLOC_INSTRUCTION);
+    if(words[0][0] == '.'){
+        words[0] = words[0].substr(1);
+        dealWithDirective(words);
         return {}; // no byte code for object file
     }
+    if(!macros.empty()){ // macros shadow instructions, so a macro can be called push_all
+        unordered_map<string, Macro>::iterator macro = macros.find(words[0]);
+        if(macro != macros.end()){
+            expandMacro(macro->second, vector<string>(words.begin()+1, words.end()));
+            return {}; // expanded lines already wrote their bytes
+        }
+    }
     //if(current_section == nullptr) handleError("Can't have instruction outside of a section.");
     if(current_section->name == "UND") handleError("Can't have instruction outside of a section.");
-    vector<string> words = tm->extractWords(instruction);
+    if(current_section->nobits()) handleError("Can't have instructions in nobits section " + current_section->name + ".");
     //cout<<"INSTRUCTION: "<< words[0]<<" ";
     //for(int i = 1; i<words.size(); i++) cout<<words[i]<<" ";
     //cout<<endl;
     //cout<<"SECTION: "<<current_section->name<<endl;
     // index 0 - mnemonic, index 1 - first operand, index 2 - second operand
-    Instruction* inst = std::find_if(instruction_set.begin(), instruction_set.end(), find_instruction(words[0])).base();
+    vector<Instruction>::iterator found = std::find_if(instruction_set.begin(), instruction_set.end(), find_instruction(words[0]));
+    if(found == instruction_set.end()) handleError("Illegal instruction.");
+    Instruction* inst = found.base();
     //cout<<"INSTRUKCIJA: "<<inst->name<<endl;
-    if(inst->name == "") handleError("Illegal instruction.");
     if(words.size()-1 != inst->operand_number) handleError("Illegal number of operands.");
+    if(stats != nullptr) stats->countInstruction(inst->name);
+    int addend[3] = {0, 0, 0}; // of the symbol in operand 1 and 2, from $table+4 and the like
+    for(size_t i = 1; i < words.size(); i++) foldOperand(words[i], addend[i]);
     /* 
         Structure of instruction:
         Instruction Description byte: OC4|OC3|OC2|OC1|OC0|S|Un|Un
@@ -148,8 +361,8 @@ vector<char> Assembler::dealWithInstruction(string instruction){
     vector<char> byte_code = {}; // array of bytes for object file ... up to 7 per instruction
     switch(inst->operand_number){
         case 0:{
-            // size bit and unsused bits are 0, no need to do anything
-            
+            // size bit and unsused bits are 0, only the instruction description byte
+            byte_code.push_back(instr_descr_byte);
             current_section->location_counter += byte_code.size();
             return byte_code;
             break;
@@ -211,17 +424,9 @@ vector<char> Assembler::dealWithInstruction(string instruction){
                 }else{
                     string symbol_name = potential_symbol;
                     if(symbol_name[0] == '*' || symbol_name[0] == '$') symbol_name = symbol_name.substr(1);
-                    SymbolTableEntry* ste = dealWithSymbol(symbol_name, 2, register_num==7 ? -2 : 0, register_num==7); // covering for pcrel also
-                    ste = st->findSymbol(symbol_name);
-                    if(ste->defined == true && ste->local==true){
-                        int off = ste->offset + (register_num==7 && ste->section==current_section->name ? -2-(current_section->location_counter+2) : -2);
-                        operand1_related_byte2 = ((off) & 0xFF);
-                        operand1_related_byte1 = ((off>>8) & 0xFF);
-                    }else{
-                        operand1_related_byte1 = 0;
-                        operand1_related_byte2 = 0;
-                    } 
-                    dealWithRelocationRecord(symbol_name, 2, register_num);
+                    short off = symbolField(symbol_name, 2, register_num, -2, addend[1]);
+                    operand1_related_byte2 = ((off) & 0xFF);
+                    operand1_related_byte1 = ((off>>8) & 0xFF);
                 }
 
                 byte_code.push_back(operand1_related_byte2);
@@ -234,17 +439,9 @@ vector<char> Assembler::dealWithInstruction(string instruction){
             if(address_mode == 0x0){
                 string symbol_name = words[1].find('$') == string::npos ? words[1] : words[1].substr(1);
                 if(isSymbol(symbol_name)){
-                    SymbolTableEntry* ste = dealWithSymbol(symbol_name, 2); // covering for pcrel also
-                    ste = st->findSymbol(symbol_name);
-                    if(ste->defined == true && ste->local==true){
-                        int off = ste->offset;
-                        operand1_related_byte2 = ((off) & 0xFF);
-                        operand1_related_byte1 = ((off>>8) & 0xFF);
-                    }else{
-                        operand1_related_byte1 = 0;
-                        operand1_related_byte2 = 0;
-                    } 
-                    dealWithRelocationRecord(symbol_name, 2);
+                    short off = symbolField(symbol_name, 2, 10, 0, addend[1]);
+                    operand1_related_byte2 = ((off) & 0xFF);
+                    operand1_related_byte1 = ((off>>8) & 0xFF);
 
                     byte_code.push_back(operand1_related_byte2);
                     byte_code.push_back(operand1_related_byte1);
@@ -330,30 +527,10 @@ vector<char> Assembler::dealWithInstruction(string instruction){
                 }else{
                     string symbol_name = potential_symbol;
                     if(symbol_name[0] == '*' || symbol_name[0] == '$') symbol_name = symbol_name.substr(1);
-                    SymbolTableEntry* ste;
-                    if(address_mode2!=0x1 && address_mode2!=0x2 && register_num==7) SymbolTableEntry* ste = dealWithSymbol(symbol_name, 2, -5, true);
-                    else if((address_mode2==0x1 || address_mode2==0x2) && register_num==7) SymbolTableEntry* ste = dealWithSymbol(symbol_name, 2, -3, true);
-                    else SymbolTableEntry* ste = dealWithSymbol(symbol_name, 2);
-                    ste = st->findSymbol(symbol_name);
-                    if(ste->defined == true && ste->local==true){
-                        if(address_mode2!=0x1 && address_mode2!=0x2 && register_num==7) {
-                            operand1_related_byte1 = ((-5-(ste->section==current_section->name ? (current_section->location_counter+2)-ste->offset : 0))>>8) & 0xFF;
-                            operand1_related_byte2 = (-5-(ste->section==current_section->name ? (current_section->location_counter+2)-ste->offset : 0)) & 0xFF;
-                        }
-                        else if((address_mode2==0x1 || address_mode2==0x2) && register_num==7) {
-                            operand1_related_byte1 = ((-3-(ste->section==current_section->name ? (current_section->location_counter+2)-ste->offset : 0))>>8) & 0xFF;
-                            operand1_related_byte2 = (-3-(ste->section==current_section->name ? (current_section->location_counter+2)-ste->offset : 0)) & 0xFF;
-                        }
-                        else{
-                            operand1_related_byte1 = (ste->offset>>8) & 0xFF;
-                            operand1_related_byte2 = ste->offset & 0xFF;
-                        }
-                    }else{
-                        operand1_related_byte1 = 0;
-                        operand1_related_byte2 = 0;
-                    }
-
-                    dealWithRelocationRecord(symbol_name, 2, register_num);
+                    // distance from the field to the end of the instruction, the second operand has 1 or 3 bytes
+                    short off = symbolField(symbol_name, 2, register_num, (address_mode2!=0x1 && address_mode2!=0x2) ? -5 : -3, addend[1]);
+                    operand1_related_byte1 = (off>>8) & 0xFF;
+                    operand1_related_byte2 = off & 0xFF;
                 }
 
                 address_field_offset += 2;
@@ -364,18 +541,11 @@ vector<char> Assembler::dealWithInstruction(string instruction){
             if(address_mode1 == 0x0){
                 string symbol_name = words[1].find('$') == string::npos ? words[1] : words[1].substr(1);
                 if(isSymbol(symbol_name)){
-                    SymbolTableEntry* ste = dealWithSymbol(symbol_name, 2); // covering for pcrel also
-                    ste = st->findSymbol(symbol_name);
-                    if(ste->defined == true && ste->local==true){
-                        int off = ste->offset;
-                        operand1_related_byte2 = ((off) & 0xFF);
-                        operand1_related_byte1 = ((off>>8) & 0xFF);
-                    }else{
-                        operand1_related_byte1 = 0;
-                        operand1_related_byte2 = 0;
-                    } 
-                    dealWithRelocationRecord(symbol_name, 2);
+                    short off = symbolField(symbol_name, 2, 10, 0, addend[1]);
+                    operand1_related_byte2 = ((off) & 0xFF);
+                    operand1_related_byte1 = ((off>>8) & 0xFF);
 
+                    address_field_offset += 2;
                     byte_code.push_back(operand1_related_byte2);
                     byte_code.push_back(operand1_related_byte1);
                 }
@@ -438,18 +608,9 @@ vector<char> Assembler::dealWithInstruction(string instruction){
                 }else{
                     string symbol_name = potential_symbol;
                     if(symbol_name[0] == '*' || symbol_name[0] == '$') symbol_name = symbol_name.substr(1);
-                    SymbolTableEntry* ste = dealWithSymbol(symbol_name, address_field_offset, register_num==7 ? -2:0, register_num==7);
-                    ste = st->findSymbol(symbol_name);
-                    if(ste->defined == true && ste->local==true){
-                        int off = (register_num==7 ? (-2-(ste->section==current_section->name ? current_section->location_counter+address_field_offset-ste->offset:0)):ste->offset);
-                        operand2_related_byte1 = (off>>8) & 0xFF;
-                        operand2_related_byte2 = (off) & 0xFF;
-                    }else{
-                        operand2_related_byte1 = 0;
-                        operand2_related_byte2 = 0;
-                    }
-
-                    dealWithRelocationRecord(symbol_name, (address_mode1==0x1 || address_mode1==0x2) ? 3 : 5, register_num);
+                    short off = symbolField(symbol_name, address_field_offset, register_num, -2, addend[2]);
+                    operand2_related_byte1 = (off>>8) & 0xFF;
+                    operand2_related_byte2 = (off) & 0xFF;
                 }
                 byte_code.push_back(operand2_related_byte2);
                 byte_code.push_back(operand2_related_byte1);
@@ -461,17 +622,9 @@ vector<char> Assembler::dealWithInstruction(string instruction){
             if(address_mode2 == 0x0){
                 string symbol_name = words[2].find('$') == string::npos ? words[2] : words[2].substr(1);
                 if(isSymbol(symbol_name)){
-                    SymbolTableEntry* ste = dealWithSymbol(symbol_name, address_field_offset); // covering for pcrel also
-                    ste = st->findSymbol(symbol_name);
-                    if(ste->defined == true && ste->local==true){
-                        int off = ste->offset;
-                        operand1_related_byte2 = ((off) & 0xFF);
-                        operand1_related_byte1 = ((off>>8) & 0xFF);
-                    }else{
-                        operand1_related_byte1 = 0;
-                        operand1_related_byte2 = 0;
-                    } 
-                    dealWithRelocationRecord(symbol_name, 2);
+                    short off = symbolField(symbol_name, address_field_offset, 10, 0, addend[2]);
+                    operand1_related_byte2 = ((off) & 0xFF);
+                    operand1_related_byte1 = ((off>>8) & 0xFF);
 
                     byte_code.push_back(operand1_related_byte2);
                     byte_code.push_back(operand1_related_byte1);
@@ -503,130 +656,50 @@ vector<char> Assembler::dealWithInstruction(string instruction){
     return {};
 }
 
-void Assembler::dealWithDirective(string directive){
-    //cout<<"DIRECTIVE: "<<directive<<endl;
-    vector<string> words = tm->extractWords(directive); 
+void Assembler::dealWithDirective(vector<string>& words){
+    ALLOC_SCOPE(ALLOC_DIRECTIVE);
+    //cout<<"DIRECTIVE: "<<words[0]<<endl;
     if(directive_map.find(words[0]) == directive_map.end()) handleError("Directive does not exist.");
     switch (directive_map[words[0]])
     {
-    case 0: // .section
+    case 0: // .section name[, "flags"[, @type]]
+    {
+        size_t known = sections.size();
         dealWithSection(words[1]);
+        if(words.size() < 3) break; // reopening keeps the attributes
+        if(words.size() > 4 || words[2].size() < 2 || words[2][0] != '"' || words[2][words[2].size()-1] != '"') handleError("Expected quoted section flags.");
+        int flags = current_section->flags;
+        if(!current_section->setFlags(words[2].substr(1, words[2].size()-2), words.size() > 3 ? words[3] : "")) handleError("Unknown section flags " + words[2] + (words.size() > 3 ? " " + words[3] : "") + ".");
+        if(sections.size() == known && current_section->flags != flags) handleError("Section " + current_section->name + " was declared with other flags.");
         break;
+    }
     case 1: // .equ
     {   
         string symbol_name = words[1];
-        vector<IndexTableEntry> index_table = {};
-        UncomputableSymbolTableEntry* uste = new UncomputableSymbolTableEntry(symbol_name, index_table);
-        int offset = 0;
-        int sign=1; // 1 --> + | -1 --> -
-        bool last; // true --> symbol | false --> operator
-        vector<string> divided = divideEquOperands(words[2]);
-        for(int i = 0; i<divided.size(); i++){
-            if(divided[i] == "+"){
-                sign=1;
-                last = false;
-                continue;
-            }
-            else if(divided[i] == "-"){
-                sign = -1;
-                last = false;
-                continue;
-            }
-            else {
-                last = true;
-                if(isSymbol(divided[i])){
-                    SymbolTableEntry* found = st->findSymbol(divided[i]);
-                    if(found == nullptr) {
-                        st->addSymbol(*(new SymbolTableEntry(divided[i])));
-                        uste->needed_symbols.push_back(to_string(sign) + divided[i]);
-                        continue;
-                    }
-                    if(found->section == "ABS") {
-                        offset += sign*found->offset;
-                        continue;
-                    };
-                    if(found->defined == false){
-                        if(found->externn == true){ // always add +1 on extern symbols regardless of sign
-                            vector<IndexTableEntry>::iterator it = std::find_if(index_table.begin(), index_table.end(), find_index_table_entry(found->section));
-                            if(it == index_table.end()){
-                                index_table.push_back(*(new IndexTableEntry(found->section, 1)));
-                            }
-                            else{
-                                it.base()->value += 1;
-                            }
-                        }
-                        else {uste->needed_symbols.push_back(to_string(sign) + divided[i]);}
-                    }
-                    else{ 
-                        offset += sign*found->offset;
-                        vector<IndexTableEntry>::iterator it = std::find_if(index_table.begin(), index_table.end(), find_index_table_entry(found->section));
-                        if(it == index_table.end()){
-                            index_table.push_back(*(new IndexTableEntry(found->section, sign)));
-                        }
-                        else{
-                            it.base()->value += sign;
-                        }
-                    }
-                }else{
-                    offset += sign*getInt(divided[i]);
-                }
-            }
+        // operands may be split by blanks, "A + 1" and "A+1" are the same
+        string text = "";
+        for(size_t i = 2; i < words.size(); i++) text += (i > 2 ? " " : "") + words[i];
+        UncomputableSymbolTableEntry uste(symbol_name);
+        if(!uste.expression.compile(text, st)) handleError(uste.expression.error);
+        for(string& name: uste.expression.symbols){
+            if(st->findSymbol(name) == nullptr) st->addSymbol(SymbolTableEntry(name));
         }
-        //cout<<"NEEDED: "<<uste->needed_symbols.size()<<endl;
-        if(uste->needed_symbols.size() > 0){
-                uste->offset = offset;
-                uste->it = index_table;
-                ust.push_back(*uste);
-                SymbolTableEntry* found = st->findSymbol(symbol_name);
-                if(found == nullptr) st->addSymbol(*(new SymbolTableEntry(symbol_name, "UND", offset, true, false)));
-                else{
-                    found->section = current_section->name.substr(1);
-                    found->offset = offset;
-                    //found->local = true;
-                    found->defined = false;
-                }
-        }else{
-            int num = 0;
-            map<string, int> section_name_map = {};
-            for(IndexTableEntry ite: index_table){
-                if (section_name_map.find(ite.section) != section_name_map.end()) section_name_map[ite.section] = 0;
-                section_name_map[ite.section] += 1;
-                if(ite.value != 0 && ite.value != 1) handleError("Illegal expression.");
-                if(ite.value == 1 && num == 0) num = 1;
-                else if(ite.value ==1 && num == 1) handleError("Illegal expression.");
-            }
-            SymbolTableEntry* found = st->findSymbol(symbol_name);
-
-            // determin which section left symbol belongs to
-            string section_name="UND";
-            map<string, int>::iterator it;
-            int max_value = 0;
-            for ( it = section_name_map.begin(); it != section_name_map.end(); it++ ){
-                if(it->second > max_value) max_value = it->second;
-            }
-
-            for ( it = section_name_map.begin(); it != section_name_map.end(); it++ ){
-                if(it->second == max_value){
-                    section_name = it->first;
-                    break;
-                }
-            }
-
-            if(found == nullptr) st->addSymbol(*(new SymbolTableEntry(symbol_name, num==0 ? "ABS" : section_name, offset, num!=0, true, false)));
-            else{
-                found->section = num==0 ? "ABS" : section_name;
-                found->offset = offset;
-                found->local = (found->section!="UND");
-                found->defined = true;
-            }
-            // if(num != 0) dealWithRelocationRecord(symbol_name); dont need reloc record for directive
+        string missing = "";
+        if(resolveUSTEntry(uste, missing)) break;
+        // waits for missing, resolveUST() evaluates it again
+        ust.push_back(uste);
+        SymbolTableEntry* found = st->findSymbol(symbol_name);
+        if(found == nullptr) st->addSymbol(SymbolTableEntry(symbol_name, "UND", 0, true, false));
+        else{
+            found->section = "UND"; // like a new symbol above, resolveUST() sets the real one
+            found->offset = 0;
+            found->defined = false;
         }
         break;
     }
     case 2: // .end
     {
-        end();
-        exit(0);
+        finished = true;
         break;
     }
     case 3: // .global
@@ -637,26 +710,34 @@ void Assembler::dealWithDirective(string directive){
         break;
     case 5: // .byte
     {
+        if(current_section->nobits()) handleError("Can't have initialized data in nobits section " + current_section->name + ".");
+        if(appendLiterals(words, 1)) break;
         char byte;
         for(int i=1; i<words.size(); i++){
+            int addend = 0;
+            foldOperand(words[i], addend);
             if(isSymbol(words[i])){
                 //cout<<"WORDS: "<<words[i]<<endl;
                 SymbolTableEntry* found = st->findSymbol(words[i]);
                 if(found == nullptr){
-                    st->addSymbol(*(new SymbolTableEntry(words[i])));
+                    st->addSymbol(SymbolTableEntry(words[i]));
                     SymbolTableEntry* added = st->findSymbol(words[i]);
-                    added->addForwardReference(*(new ForwardReferenceTableEntry(current_section->location_counter, current_section->name[0] == '.' ? current_section->name.substr(1) : current_section->name)));
-                    current_section->getMachineCode().push_back(0 & 0xFF);
+                    added->addForwardReference(ForwardReferenceTableEntry(current_section->location_counter, current_section->name[0] == '.' ? current_section->name.substr(1) : current_section->name, addend, false, 1));
+                    current_section->getMachineCode().push_back(addend & 0xFF);
                 }else{
                     if(found->defined != false){
-                        current_section->getMachineCode().push_back(found->offset & 0xFF);
+                        current_section->getMachineCode().push_back(((found->local || found->section == "ABS" ? found->offset : 0) + addend) & 0xFF); // globals are relocated by their own address, constants are not relocated
                     }
                     else {
-                        found->addForwardReference(*(new ForwardReferenceTableEntry(current_section->location_counter, current_section->name[0] == '.' ? current_section->name.substr(1) : current_section->name)));
+                        found->addForwardReference(ForwardReferenceTableEntry(current_section->location_counter, current_section->name[0] == '.' ? current_section->name.substr(1) : current_section->name, addend, false, 1));
+                        current_section->getMachineCode().push_back(addend & 0xFF);
                     }
                 }
 
-                dealWithRelocationRecord(words[i], 0);
+                if(found == nullptr || !found->defined || found->section != "ABS"){
+                    dealWithRelocationRecord(words[i], 0);
+                    current_section->relocation_table.back().type = "R_386_8"; // the field is a single byte
+                }
             }
             else{
                 byte = (char)getInt(words[i]);
@@ -668,35 +749,34 @@ void Assembler::dealWithDirective(string directive){
         }
     case 6: // .word
     {
+        if(current_section->nobits()) handleError("Can't have initialized data in nobits section " + current_section->name + ".");
+        if(appendLiterals(words, 2)) break;
         short int word;
         for(int i=1; i<words.size(); i++){
+            int addend = 0;
+            foldOperand(words[i], addend);
             if(isSymbol(words[i])){
                 SymbolTableEntry* found = st->findSymbol(words[i]);
                 if(found == nullptr){
-                    st->addSymbol(*(new SymbolTableEntry(words[i])));
+                    st->addSymbol(SymbolTableEntry(words[i]));
                     SymbolTableEntry* added = st->findSymbol(words[i]);
-                    added->addForwardReference(*(new ForwardReferenceTableEntry(current_section->location_counter, current_section->name[0] == '.' ? current_section->name.substr(1) : current_section->name)));
-                    current_section->getMachineCode().push_back(0 & 0xFF);
-                    current_section->getMachineCode().push_back(0 & 0xFF);
+                    added->addForwardReference(ForwardReferenceTableEntry(current_section->location_counter, current_section->name[0] == '.' ? current_section->name.substr(1) : current_section->name, addend));
+                    current_section->getMachineCode().push_back(addend & 0xFF);
+                    current_section->getMachineCode().push_back((addend>>8) & 0xFF);
                 }else{
                     if(found->defined != false){
-                        current_section->getMachineCode().push_back(found->offset & 0xFF);
-                        current_section->getMachineCode().push_back((found->offset>>8) & 0xFF);
+                        short int value = (found->local || found->section == "ABS" ? found->offset : 0) + addend; // globals are relocated by their own address, constants are not relocated
+                        current_section->getMachineCode().push_back(value & 0xFF);
+                        current_section->getMachineCode().push_back((value>>8) & 0xFF);
                     }else{
                         //cout<<"POS: "<<current_section->location_counter<<endl;
-                        if(found->externn==true){
-                            current_section->getMachineCode().push_back(0 & 0xFF);
-                            current_section->getMachineCode().push_back(0 & 0xFF);
-                        }
-                        else{
-                            found->addForwardReference(*(new ForwardReferenceTableEntry(current_section->location_counter, current_section->name[0] == '.' ? current_section->name.substr(1) : current_section->name)));
-                            current_section->getMachineCode().push_back(0 & 0xFF);
-                            current_section->getMachineCode().push_back(0 & 0xFF);
-                        }
+                        if(found->externn!=true) found->addForwardReference(ForwardReferenceTableEntry(current_section->location_counter, current_section->name[0] == '.' ? current_section->name.substr(1) : current_section->name, addend));
+                        current_section->getMachineCode().push_back(addend & 0xFF);
+                        current_section->getMachineCode().push_back((addend>>8) & 0xFF);
                     }
                 }
 
-                dealWithRelocationRecord(words[i], 0);
+                if(found == nullptr || !found->defined || found->section != "ABS") dealWithRelocationRecord(words[i], 0);
             }
             else{
                 word = (short int)getInt(words[i]);
@@ -708,16 +788,276 @@ void Assembler::dealWithDirective(string directive){
         break;
     }
     case 7: // .skip
+    {
         int num_of_bytes = getInt(words[1]);
+        if(current_section->nobits()){ // only the size is kept
+            current_section->location_counter += num_of_bytes;
+            break;
+        }
         for(int i = 0; i < num_of_bytes; i++){
             current_section->getMachineCode().push_back(0);
             current_section->location_counter += 1;
         }
         break;
     }
+    case 8: // .incbin "file"[, offset[, length]]
+    {
+        if(current_section->name == "UND") handleError("Can't have data outside of a section.");
+        if(current_section->nobits()) handleError("Can't have initialized data in nobits section " + current_section->name + ".");
+        if(words.size() < 2 || words[1].size() < 2 || words[1][0] != '"' || words[1][words[1].size()-1] != '"') handleError("Expected quoted file name.");
+        string file_name = words[1].substr(1, words[1].size()-2);
+        long long offset = words.size() > 2 ? getInt(words[2]) : 0;
+        long long length = words.size() > 3 ? getInt(words[3]) : -1;
+        includeBinary(file_name, offset, length);
+        break;
+    }
+    case 9: // .macro name[ parameter[=default], ...]
+    {
+        if(words.size() < 2) handleError("Macro name is missing.");
+        if(macros.find(words[1]) != macros.end()) handleError("Macro " + words[1] + " is already defined.");
+        recording = new Macro(words[1], sourceLine());
+        for(size_t i = 2; i < words.size(); i++){
+            size_t equals = words[i].find('=');
+            recording->parameters.push_back(words[i].substr(0, equals));
+            recording->defaults.push_back(equals == string::npos ? "" : words[i].substr(equals+1));
+        }
+        recording_depth = 1;
+        rept_count = -1;
+        break;
+    }
+    case 10: // .endm
+        handleError(".endm without .macro.");
+        break;
+    case 11: // .rept count
+    {
+        if(words.size() < 2) handleError("Repeat count is missing.");
+        rept_count = getInt(words[1]);
+        if(rept_count < 0) handleError("Repeat count can't be negative.");
+        recording = new Macro(".rept", sourceLine());
+        recording_depth = 1;
+        break;
+    }
+    case 12: // .endr
+        handleError(".endr without .rept.");
+        break;
+    case 13: // .if/.ifdef/.ifndef/.else/.endif
+        dealWithConditional(words);
+        break;
+    case 14: // .include "file"
+        if(words.size() != 2 || words[1].size() < 2 || words[1][0] != '"' || words[1][words[1].size()-1] != '"') handleError("Expected quoted file name.");
+        includeFile(words[1].substr(1, words[1].size()-2));
+        break;
+    }
+}
+
+void Assembler::dealWithConditional(vector<string>& words){
+    if(words[0] == "else" || words[0] == "endif"){
+        if(conditionals.empty()) handleError("." + words[0] + " without .if.");
+        if(words[0] == "endif"){
+            conditionals.pop_back();
+            return;
+        }
+        enterElse();
+        return;
+    }
+    if(words.size() < 2) handleError("." + words[0] + " needs an operand.");
+    bool value;
+    if(words[0] == "if") value = evaluateCondition(words) != 0;
+    else{
+        if(words.size() != 2) handleError("." + words[0] + " takes one symbol.");
+        SymbolTableEntry* found = st->findSymbol(words[1]);
+        value = (found != nullptr && found->defined) == (words[0] == "ifdef");
+    }
+    conditionals.push_back(Conditional(sourceLine(), value));
+}
+
+int Assembler::evaluateCondition(vector<string>& words){
+    // operands may be split by blanks, "A == 1" and "A==1" are the same
+    string text = "";
+    for(size_t i = 1; i < words.size(); i++) text += (i > 1 ? " " : "") + words[i];
+    Expression expression;
+    if(!expression.compile(text, st)) handleError(expression.error);
+    // constants defined by now are folded by compile(), anything left is a label or not defined yet
+    if(!expression.isConstant()) handleError("Symbol " + expression.symbols[0] + " in .if is not a constant defined before it.");
+    return expression.program[0].value;
+}
+
+void Assembler::skipLine(const string& line){
+    // only the first word matters, and only if it is a directive: blanks, an optional label, then .name
+    size_t n = line.size();
+    size_t i = 0;
+    while(i < n && (line[i] == ' ' || line[i] == '\t')) i++;
+    if(i < n && line[i] != '.'){
+        size_t word = i;
+        while(i < n && (isalnum(line[i]) || line[i] == '_')) i++;
+        if(i == word || i == n || line[i] != ':') return;
+        i++;
+        while(i < n && (line[i] == ' ' || line[i] == '\t')) i++;
+    }
+    if(i == n || line[i] != '.') return;
+    size_t name = ++i;
+    while(i < n && isalpha(line[i])) i++;
+    if(i < n && (isalnum(line[i]) || line[i] == '_')) return; // .if_x is not .if
+    skipDirective(line.c_str() + name, i - name);
+}
+
+void Assembler::skipDirective(const char* name, size_t length){
+    if((length == 2 && memcmp(name, "if", 2) == 0) || (length == 5 && memcmp(name, "ifdef", 5) == 0) || (length == 6 && memcmp(name, "ifndef", 6) == 0)){
+        skipped_depth++;
+        return;
+    }
+    if(skipped_depth > 0){
+        if(length == 5 && memcmp(name, "endif", 5) == 0) skipped_depth--;
+        return;
+    }
+    // belongs to the skipped block itself
+    if(length == 5 && memcmp(name, "endif", 5) == 0) conditionals.pop_back();
+    else if(length == 4 && memcmp(name, "else", 4) == 0) enterElse();
+}
+
+void Assembler::enterElse(){
+    Conditional& conditional = conditionals.back();
+    if(conditional.in_else) handleError(".else after .else for the .if on line:" + to_string(conditional.line) + ".");
+    conditional.in_else = true;
+    conditional.active = !conditional.taken;
+    conditional.taken = true;
+}
+
+string Assembler::resolveIncluded(string file_name){
+    string including_file = include_stack.size() > 0 ? include_stack.back().path : input_file_name;
+    string path = IncludeCache::resolve(file_name, including_file);
+    if(path == "") handleError("File " + file_name + " cannot be opened.");
+    return path;
+}
+
+void Assembler::includeFile(string file_name){
+    string path = resolveIncluded(file_name);
+    if(path == IncludeCache::resolve(input_file_name, "")) handleError("File " + file_name + " includes itself.");
+    for(size_t i = 0; i < include_stack.size(); i++){
+        if(include_stack[i].path != path) continue;
+        string chain = "";
+        for(size_t j = i; j < include_stack.size(); j++) chain += include_stack[j].name + " -> ";
+        handleError("Circular .include: " + chain + file_name + ".");
+    }
+    string error = "";
+    shared_ptr<IncludedFile> file = IncludeCache::get(path, [this](const string& line){
+        if(tm->isEmpty(line) || line[0] == '#') return vector<string>();
+        return lexLine(line);
+    }, error);
+    if(file == nullptr) handleError(error);
+    if(file->guard != ""){ // guarded file included before, nothing of it would be assembled
+        SymbolTableEntry* guard = st->findSymbol(file->guard);
+        if(guard != nullptr && guard->defined) return;
+    }
+    size_t open_conditionals = conditionals.size();
+    include_stack.push_back(IncludeFrame(path, file_name, expansion_stack.size()));
+    for(const IncludedLine& line: file->lines){
+        if(finished) break;
+        include_stack.back().line = line.line;
+        vector<string> tokens = line.tokens; // processing rewrites tokens, the cached ones are shared
+        if(recording != nullptr){
+            recordLine(tokens);
+            continue;
+        }
+        vector<char> bytes = processTokens(tokens);
+        if(bytes.size() > 0) current_section->getMachineCode().insert(current_section->machine_code.end(), bytes.begin(), bytes.end());
+    }
+    if(recording != nullptr) handleError("Missing " + string(rept_count < 0 ? ".endm" : ".endr") + " for the definition on line:" + to_string(recording->line) + ".");
+    if(conditionals.size() > open_conditionals) handleError("Missing .endif for the .if on line:" + to_string(conditionals.back().line) + ".");
+    if(conditionals.size() < open_conditionals) handleError(".endif closes an .if of the including file.");
+    include_stack.pop_back();
+}
+
+void Assembler::includeBinary(string file_name, long long offset, long long length){
+    int fd = open(resolveIncluded(file_name).c_str(), O_RDONLY);
+    if(fd < 0) handleError("File " + file_name + " cannot be opened.");
+    struct stat info;
+    fstat(fd, &info);
+    long long size = info.st_size;
+    if(length < 0) length = size - offset;
+    if(offset < 0 || offset > size || length < 0 || offset + length > size){
+        close(fd);
+        handleError("Range is outside of " + file_name + " (" + to_string(size) + " bytes).");
+    }
+    if(length > 0){
+        // map the whole file and copy the range straight into the section, the bytes never become text
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapped == MAP_FAILED){
+            close(fd);
+            handleError("File " + file_name + " cannot be mapped.");
+        }
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        const char* begin = (const char*)mapped + offset;
+        current_section->getMachineCode().insert(current_section->machine_code.end(), begin, begin + length);
+        munmap(mapped, size);
+    }
+    close(fd);
+    current_section->location_counter += length;
+}
+
+bool Assembler::parseLiteral(const string& x, int& value){
+    // same results as isSymbol + getInt for plain numbers, anything else returns false
+    size_t n = x.size();
+    if(n == 0) return false;
+    value = 0;
+    if(x[0] == '0'){
+        if(n > 2 && (x[1] == 'x' || x[1] == 'X')){
+            if(n > 9) return false;
+            for(size_t i = 2; i < n; i++){
+                char c = x[i];
+                int digit = isdigit(c) ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+                if(digit < 0) return false;
+                value = value * 16 + digit;
+            }
+            return true;
+        }
+        if(n > 2 && (x[1] == 'b' || x[1] == 'B')){
+            if(n > 32) return false;
+            for(size_t i = 2; i < n; i++){
+                if(x[i] != '0' && x[i] != '1') return false;
+                value = value * 2 + (x[i] - '0');
+            }
+            return true;
+        }
+        if(n > 11) return false;
+        for(size_t i = 1; i < n; i++){
+            if(x[i] < '0' || x[i] > '7') return false;
+            value = value * 8 + (x[i] - '0');
+        }
+        return true;
+    }
+    size_t i = (x[0] == '-' || x[0] == '+') ? 1 : 0;
+    if(n == i || n - i > 9) return false;
+    for(size_t j = i; j < n; j++){
+        if(!isdigit(x[j])) return false;
+        value = value * 10 + (x[j] - '0');
+    }
+    if(x[0] == '-') value = -value;
+    return true;
+}
+
+bool Assembler::appendLiterals(const vector<string>& words, int size){
+    // fast path for .byte/.word tables: when every operand is a number, parse them all
+    // and append the whole line with one resize instead of going through the symbol checks
+    int value;
+    for(size_t i = 1; i < words.size(); i++){
+        if(!parseLiteral(words[i], value)) return false;
+    }
+    vector<char>& code = current_section->getMachineCode();
+    size_t at = code.size();
+    code.resize(at + (words.size()-1) * size);
+    char* out = code.data() + at;
+    for(size_t i = 1; i < words.size(); i++){
+        parseLiteral(words[i], value);
+        *out++ = value & 0xFF;
+        if(size == 2) *out++ = (value >> 8) & 0xFF; // little endian
+    }
+    current_section->location_counter += (words.size()-1) * size;
+    return true;
 }
 
 int Assembler::getInt(string operand){
+    ALLOC_SCOPE(ALLOC_OPERAND);
     int ret=0;
     if(operand[0]=='*' || operand[0]=='$') operand = operand.substr(1);
     if(operand[0]== '\''){
@@ -751,10 +1091,11 @@ int Assembler::getInt(string operand){
 }
 
 void Assembler::defineSymbol(string symbol, bool local, bool defined, bool ext/*=false*/){
+    ALLOC_SCOPE(ALLOC_SYMBOL);
     SymbolTableEntry* found = st->findSymbol(symbol);
     string sect_name = current_section->name[0] == '.' ? current_section->name.substr(1) : current_section->name;
     if(found == nullptr) st->addSymbol
-    (*(new SymbolTableEntry(symbol, ext ? "UND" : sect_name, ext ? 0 : current_section->location_counter, local, defined, ext)));
+    (SymbolTableEntry(symbol, ext ? "UND" : sect_name, ext ? 0 : current_section->location_counter, local, defined, ext));
     else
     {
         if(found->section == "UND" && found->externn) handleError("Symbol " + found->name + " is already declared as extern.");
@@ -770,6 +1111,7 @@ void Assembler::dealWithComment(string comment){
 }
 
 void Assembler::dealWithRelocationRecord(string symbol, int instruction_offset, int register_num/*=10*/, string section/*=""*/){
+    ALLOC_SCOPE(ALLOC_RELOCATION);
     //cout<<"RELOC FOR: "<<symbol<<" IN SECTION:" << current_section->name<<endl;
     bool null_flag = false;
     if(current_section == nullptr) {
@@ -784,12 +1126,13 @@ void Assembler::dealWithRelocationRecord(string symbol, int instruction_offset,
     SymbolTableEntry *sectionSymbol = st->findSymbol(ste->section);
     if(sectionSymbol == nullptr) sectionSymbol = st->findSymbol(""); // UND section
 
-    current_section->relocation_table.push_back(*(new RelocationTableEntry(current_section->location_counter+instruction_offset, 
-    ste->local ? sectionSymbol->id : ste->id, type, symbol)));
+    current_section->relocation_table.push_back(RelocationTableEntry(current_section->location_counter+instruction_offset, 
+    ste->local ? sectionSymbol->id : ste->id, type, symbol));
     if(null_flag) current_section = nullptr;
 }
 
 char Assembler::getAdressingMode(string operand, bool is_jump){
+    ALLOC_SCOPE(ALLOC_OPERAND);
     if(is_jump){
         if(operand[0] == '*'){
             switch(operand[1]){
@@ -843,7 +1186,7 @@ int Assembler::determineRegister(string operand){
 char Assembler::higherByteRegister(string operand){
     int start = operand.find('%');
     if(start == string::npos) {
-        cout<<"ERROR: REGISTER COULDNT BE FOUND IN OPERAND "<<operand<<endl;
+        cerr<<"ERROR: REGISTER COULDNT BE FOUND IN OPERAND "<<operand<<endl;
         return 16;
     }
     string rgstr = operand.substr(start+1, 3);
@@ -851,47 +1194,182 @@ char Assembler::higherByteRegister(string operand){
 }
 
 SymbolTableEntry* Assembler::dealWithSymbol(string symbolName, int address_field_offset, int end_of_instruction/*=0*/, bool pcrel/*=false*/){
+    ALLOC_SCOPE(ALLOC_SYMBOL);
     //if(pcrel) cout<<"PCREL: "<<end_of_instruction<<endl;
     SymbolTableEntry* found = st->findSymbol(symbolName);
     if(found == nullptr){
-        st->addSymbol(*(new SymbolTableEntry(symbolName, current_section->name.substr(1), 0, true)));
+        st->addSymbol(SymbolTableEntry(symbolName)); // no section until it is defined, the relocation is fixed up in formatSection
         SymbolTableEntry* added = st->findSymbol(symbolName);
         //cout<<"ADDED: "<<added->name<<endl;
-        added->addForwardReference(*(new ForwardReferenceTableEntry(current_section->location_counter + address_field_offset, current_section->name[0] == '.' ? current_section->name.substr(1) : current_section->name, end_of_instruction, pcrel)));
+        added->addForwardReference(ForwardReferenceTableEntry(current_section->location_counter + address_field_offset, current_section->name[0] == '.' ? current_section->name.substr(1) : current_section->name, end_of_instruction, pcrel));
         return added;
     }else{
         if(found->defined == true){
             return found;
         }else{
             //cout<<"FOUND: "<<found->name<<endl;
-            found->addForwardReference(*(new ForwardReferenceTableEntry(current_section->location_counter + address_field_offset, current_section->name[0] == '.' ? current_section->name.substr(1) : current_section->name, end_of_instruction, pcrel)));
+            found->addForwardReference(ForwardReferenceTableEntry(current_section->location_counter + address_field_offset, current_section->name[0] == '.' ? current_section->name.substr(1) : current_section->name, end_of_instruction, pcrel));
             return found;
         }
     }
 }
 
 string Assembler::handleError(string error){
-    cout<<error + " On line:" + to_string(line_of_code)<<endl;
+    string location = " On line:" + to_string(line_of_code);
+    if(expansion_stack.size() > 0 || include_stack.size() > 0){ // call site first, then every included file and macro line down to the failing one
+        location += " (";
+        size_t include = 0;
+        for(size_t i = 0; i <= expansion_stack.size(); i++){
+            for(; include < include_stack.size() && include_stack[include].macro_depth <= i; include++){
+                location += (location[location.size()-1] != '(' ? ", " : "") + string("in ") + include_stack[include].name + " on line:" + to_string(include_stack[include].line);
+            }
+            if(i == expansion_stack.size()) break;
+            size_t repeated = 1; // recursion would print the same frame MAX_MACRO_DEPTH times
+            while(i+1 < expansion_stack.size() && expansion_stack[i+1].name == expansion_stack[i].name && expansion_stack[i+1].line == expansion_stack[i].line){
+                i++;
+                repeated++;
+            }
+            location += (location[location.size()-1] != '(' ? ", " : "") + string("in ") + (expansion_stack[i].name == ".rept" ? ".rept" : "macro " + expansion_stack[i].name) + " on line:" + to_string(expansion_stack[i].line);
+            if(repeated > 1) location += " x" + to_string(repeated);
+        }
+        location += ")";
+    }
+    cerr<<error + location<<endl;
     abort();
 }
 
+int Assembler::sourceLine(){
+    if(include_stack.size() > 0 && include_stack.back().macro_depth == expansion_stack.size()) return include_stack.back().line;
+    return expansion_stack.size() > 0 ? expansion_stack.back().line : line_of_code;
+}
+
+void Assembler::recordLine(vector<string>& tokens){
+    ALLOC_SCOPE(ALLOC_MACRO);
+    // nested definitions are only counted here, they are defined when the outer body is expanded
+    string directive = tokens[0].find(':') != string::npos ? (tokens.size() > 1 ? tokens[1] : "") : tokens[0];
+    if(directive == ".macro" || directive == ".rept") recording_depth++;
+    else if(directive == ".endm" || directive == ".endr"){
+        recording_depth--;
+        if(recording_depth == 0){
+            if(directive != (rept_count < 0 ? ".endm" : ".endr")) handleError(directive + " doesn't close " + (rept_count < 0 ? ".macro." : ".rept."));
+            finishRecording();
+            return;
+        }
+    }
+    MacroLine macro_line(sourceLine());
+    for(string& token: tokens) macro_line.tokens.push_back(compileMacroToken(token, recording->parameters));
+    recording->body.push_back(macro_line);
+}
+
+vector<MacroSegment> Assembler::compileMacroToken(const string& token, const vector<string>& parameters){
+    vector<MacroSegment> segments = {};
+    string text = "";
+    for(size_t i = 0; i < token.size(); i++){
+        if(token[i] != '\\' || i+1 == token.size()){
+            text += token[i];
+            continue;
+        }
+        int parameter = -1;
+        size_t end = i+1;
+        if(token[end] == '@'){
+            parameter = MACRO_COUNTER;
+            end++;
+        }
+        else{
+            while(end < token.size() && (isalnum(token[end]) || token[end] == '_')) end++;
+            string name = token.substr(i+1, end-i-1);
+            for(size_t p = 0; p < parameters.size(); p++) if(parameters[p] == name) parameter = p;
+        }
+        if(parameter == -1){ // not a parameter, keep the backslash
+            text += token[i];
+            continue;
+        }
+        if(text != "") segments.push_back(MacroSegment(text));
+        text = "";
+        segments.push_back(MacroSegment("", parameter));
+        if(token.compare(end, 2, "()") == 0) end += 2; // \() separates a parameter from following text
+        i = end-1;
+    }
+    if(text != "" || segments.size() == 0) segments.push_back(MacroSegment(text));
+    return segments;
+}
+
+void Assembler::finishRecording(){
+    ALLOC_SCOPE(ALLOC_MACRO);
+    Macro* macro = recording;
+    recording = nullptr;
+    if(rept_count < 0) macros.emplace(macro->name, *macro);
+    else {
+        int count = rept_count;
+        if(expansion_stack.size() > 0) expansion_stack.back().line = macro->line; // errors point at .rept, not .endr
+        for(int i = 0; i < count && !finished; i++) expandMacro(*macro, {});
+    }
+    delete macro;
+}
+
+void Assembler::expandMacro(Macro& macro, vector<string> arguments){
+    ALLOC_SCOPE(ALLOC_MACRO);
+    if(expansion_stack.size() >= MAX_MACRO_DEPTH) handleError("Macro expansion is nested deeper than " + to_string(MAX_MACRO_DEPTH) + " levels.");
+    if(arguments.size() > macro.parameters.size()) handleError("Too many arguments for macro " + macro.name + ".");
+    for(size_t i = arguments.size(); i < macro.parameters.size(); i++){
+        if(macro.defaults[i] == "") handleError("Missing argument " + macro.parameters[i] + " for macro " + macro.name + ".");
+        arguments.push_back(macro.defaults[i]);
+    }
+    string counter = to_string(macro_counter++);
+    expansion_stack.push_back(MacroFrame(macro.name, macro.line));
+    for(MacroLine& line: macro.body){
+        if(finished) break;
+        expansion_stack.back().line = line.line;
+        // substitute straight into the tokens, expanded lines are never lexed again
+        vector<string> tokens = {};
+        tokens.reserve(line.tokens.size());
+        for(vector<MacroSegment>& segments: line.tokens){
+            if(segments.size() == 1 && segments[0].parameter == -1){
+                tokens.push_back(segments[0].text);
+                continue;
+            }
+            string token = "";
+            for(MacroSegment& segment: segments){
+                if(segment.parameter == -1) token += segment.text;
+                else if(segment.parameter == MACRO_COUNTER) token += counter;
+                else token += arguments[segment.parameter];
+            }
+            if(token != "") tokens.push_back(token);
+        }
+        if(tokens.size() == 0) continue;
+        if(recording != nullptr){ // definition nested in this body
+            recordLine(tokens);
+            continue;
+        }
+        vector<char> bytes = processTokens(tokens);
+        if(bytes.size() > 0) current_section->getMachineCode().insert(current_section->machine_code.end(), bytes.begin(), bytes.end());
+    }
+    expansion_stack.pop_back();
+}
+
 void Assembler::dealWithSection(string section_name){
     string sect_name = section_name[0] == '.' ? section_name.substr(1) : section_name;
-    Section* found = findSection(section_name);
+    Section* found = findSection(sect_name);
     if(found != nullptr){
         current_section = found;
         return;
     }
-    current_section = new Section(sect_name);
+    unordered_map<string, Section*>::iterator spare = spare_sections.find(sect_name);
+    if(spare != spare_sections.end()){ // left by the previous run, already cleared
+        current_section = spare->second;
+        spare_sections.erase(spare);
+    }
+    else current_section = new Section(sect_name);
     sections.push_back(current_section);
-    st->addSymbol(*(new SymbolTableEntry(sect_name, sect_name, 0, true, true)));
+    section_index.emplace(sect_name, current_section);
+    st->addSymbol(SymbolTableEntry(sect_name, sect_name, 0, true, true));
     return;
 }
 
 Section* Assembler::findSection(string section_name){
-    for(Section* section: sections){
-        if(section->name == section_name) return section;
-    }
+    // sections are kept without the dot, .section .text and .section text are the same one
+    unordered_map<string, Section*>::iterator it = section_index.find(section_name[0] == '.' ? section_name.substr(1) : section_name);
+    if(it != section_index.end()) return it->second;
     return nullptr;
 }
 
@@ -906,10 +1384,69 @@ map<string,int> Assembler::createMap()
   m["byte"] = 5;
   m["word"] = 6;
   m["skip"] = 7;
+  m["incbin"] = 8;
+  m["macro"] = 9;
+  m["endm"] = 10;
+  m["rept"] = 11;
+  m["endr"] = 12;
+  m["if"] = 13;
+  m["ifdef"] = 13;
+  m["ifndef"] = 13;
+  m["else"] = 13;
+  m["endif"] = 13;
+  m["include"] = 14;
   return m;
 }
 
+short Assembler::symbolField(string symbol_name, int address_field_offset, int register_num, int end_of_instruction, int addend){
+    // field holds the addend, a PC relative one also the (negative) distance from the field to the end of instruction
+    bool pcrel = register_num == 7;
+    int value = (pcrel ? end_of_instruction : 0) + addend;
+    dealWithSymbol(symbol_name, address_field_offset, value, pcrel);
+    SymbolTableEntry* ste = st->findSymbol(symbol_name);
+    if(ste->defined == true && ste->local == true){
+        value += ste->offset;
+        if(pcrel && ste->section == current_section->name) value -= current_section->location_counter + address_field_offset;
+    }
+    dealWithRelocationRecord(symbol_name, address_field_offset, register_num);
+    return value;
+}
+
+void Assembler::foldOperand(string& operand, int& addend){
+    // the expression is what is left without $ or * in front and (%rN) behind
+    size_t begin = (operand[0] == '$' || operand[0] == '*') ? 1 : 0;
+    size_t end = operand.size();
+    if(operand[end-1] == ')'){
+        size_t reg = operand.rfind("(%");
+        if(reg != string::npos) end = reg;
+    }
+    if(begin == end || operand[begin] == '%' || (operand[begin] == '\'' && end - begin == 3)) return;
+    // plain symbols and numbers, nearly every operand, are not compiled
+    bool plain = isalnum(operand[begin]) || operand[begin] == '_' || operand[begin] == '.';
+    for(size_t i = begin + 1; plain && i < end; i++) plain = isalnum(operand[i]) || operand[i] == '_' || operand[i] == '.';
+    if(plain) return;
+    Expression expression;
+    if(!expression.compile(operand.substr(begin, end - begin), st)) handleError(expression.error);
+    string folded;
+    if(expression.isConstant()) folded = to_string(expression.program[0].value);
+    else{
+        ExpressionValue value;
+        string missing = "";
+        if(!expression.evaluate(st, BIND_SYMBOLS, value, missing)) handleError(expression.error);
+        if(value.terms.size() != 1 || value.terms[0].coefficient != 1){
+            // label2-label1 is a constant once both are known, through their sections
+            if(!expression.evaluate(st, BIND_SECTIONS, value, missing) || !value.terms.empty()) handleError("Operand " + operand + " is neither a constant nor a symbol plus a constant.");
+            folded = to_string(value.constant);
+        }else{
+            folded = value.terms[0].base;
+            addend = value.constant;
+        }
+    }
+    operand = operand.substr(0, begin) + folded + operand.substr(end);
+}
+
 bool Assembler::isSymbol(string x){
+    ALLOC_SCOPE(ALLOC_SYMBOL);
     //cout<<x<<endl;
     if(x[0]=='-' || x[0]=='+' || x[0]=='*' || x[0]=='$') x = x.substr(1);
     if(x[0]=='0') return false;
@@ -920,6 +1457,7 @@ bool Assembler::isSymbol(string x){
 }
 
 void Assembler::end(){
+    ALLOC_SCOPE(ALLOC_OUTPUT);
     // FOR TESTING
     /*current_section = nullptr;
     resolveUST();
@@ -939,161 +1477,195 @@ void Assembler::end(){
     }*/
 
     // FINAL
-    stringstream output;
+    TraceScope trace("Assembler::end");
     current_section = nullptr;
-    resolveUST();
-    for(Section* section: sections){
-        st->backpatch(section->machine_code, section->name);
-
-        // cleaning relocation tables of potential unnecessary relocation records
-        vector<RelocationTableEntry>::iterator itr;
-        for( itr = section->relocation_table.begin(); itr != section->relocation_table.end();){
-            if(itr->value == 0){ // relocation to a UND section
-                SymbolTableEntry* ste = st->findSymbol(itr->symbol_name);
-                if(!ste->externn && ste->local){ // if symbol is not extern and is local
-                    itr->value = st->findSymbol(ste->section)->id;
-                }else{
-                    itr->value = ste->id;
-                }
-            }
-            if(itr->type == "R_386_PC16" && st->findSymbol(itr->symbol_name)->section == section->name) itr = section->relocation_table.erase(itr); // erase uneccessary relocation records
-            else itr++;
+    {
+        PhaseTimer timer(stats, PHASE_RESOLVE);
+        TraceScope trace_resolve("Assembler::resolveUST");
+        resolveUST();
+    }
+    if(sections.size() > 0) st->checkDefined();
+    if(emit_prelude){
+        if(sections.size() > 0){
+            cerr<<"A prelude can't contain sections, only .equ, .extern and .global."<<endl;
+            exit(1);
+        }
+        PhaseTimer timer(stats, PHASE_WRITE);
+        fm->setContent(st->toSnapshot(2), output_file_name); // UND and ABS entries are made by every Assembler
+        return;
+    }
+    st->indexForwardReferences();
+
+    // once symbols are final every section can be backpatched and formatted on its own
+    relocation_texts.assign(sections.size(), "");
+    machine_code_texts.assign(sections.size(), "");
+    atomic<size_t> next_section(0);
+    auto worker = [&](){
+        for(size_t i = next_section++; i < sections.size(); i = next_section++){
+            formatSection(sections[i], relocation_texts[i], machine_code_texts[i]);
         }
+    };
+    size_t worker_count = thread::hardware_concurrency();
+    if(worker_count > sections.size()) worker_count = sections.size();
+    vector<thread> workers = {};
+    vector<char> tokens = {};
+    for(size_t i = 1; i < worker_count; i++){ // calling thread is a worker too
+        char token;
+        if(Jobserver::active != nullptr && !Jobserver::active->tryAcquire(token)) break; // under make -j every extra thread costs a token
+        if(Jobserver::active != nullptr) tokens.push_back(token);
+        workers.push_back(thread(worker));
+    }
+    worker();
+    for(thread& t: workers) t.join();
+    for(char token: tokens) Jobserver::active->release(token);
+    {
+        PhaseTimer timer(stats, PHASE_FORMAT);
+        symbol_table_text = st->toString(); // patch() never changes the table
+    }
+    writeObject();
+
+    if(stats != nullptr){
+        stats->symbols = st->table.size();
+        for(SymbolTableEntry& ste: st->table) stats->forward_references += ste.forward_reference_table.size();
+        for(Section* section: sections){
+            stats->relocations += section->relocation_table.size();
+            stats->sections.push_back(SectionStatistics(section->name, section->machine_code.size(), section->relocation_table.size()));
+        }
+    }
+}
 
-        output<<"#.ret"<<section->name<<endl;
-        output<<section->getRelocationTable()<<endl;
+void Assembler::formatSection(Section* section, string& relocation_table, string& machine_code){
+    ALLOC_SCOPE(ALLOC_OUTPUT);
+    TraceScope trace("Assembler::formatSection", "section", section->name);
+    {
+        PhaseTimer timer(stats, PHASE_BACKPATCH);
+        TraceScope trace_backpatch("SymbolTable::backpatch");
+        st->backpatch(section->machine_code, section->name);
     }
 
-    output<<st->toString();
+    {
+        PhaseTimer timer(stats, PHASE_RELOCATIONS);
+        TraceScope trace_relocations("relocations");
+        // cleaning relocation tables of potential unnecessary relocation records, compacting in place
+        vector<RelocationTableEntry>& relocations = section->relocation_table;
+        size_t kept = 0;
+        for(size_t i = 0; i < relocations.size(); i++){
+            RelocationTableEntry& rte = relocations[i];
+            if(!finalizeRelocation(rte, section)) continue;
+            if(kept != i) relocations[kept] = rte;
+            kept++;
+        }
+        relocations.erase(relocations.begin() + kept, relocations.end());
+    }
 
+    PhaseTimer timer(stats, PHASE_FORMAT);
+    TraceScope trace_format("format");
+    relocation_table = section->getRelocationTable();
+    machine_code = section->getMachineCodeString();
+}
 
-    output<<"MACHINE CODE:"<<endl;
-    for(Section* s: sections){
-        output<<"#"<<s->name<<endl;
-        output<<s->getMachineCodeString()<<endl;
+bool Assembler::finalizeRelocation(RelocationTableEntry& rte, Section* section){
+    bool pcrel = rte.type == "R_386_PC16";
+    SymbolTableEntry* ste = (rte.value == 0 || pcrel) ? st->findSymbol(rte.symbol_name) : nullptr;
+    if(rte.value == 0){ // relocation to a UND section
+        if(!ste->externn && ste->local){ // if symbol is not extern and is local
+            rte.value = st->findSymbol(ste->section)->id;
+        }else{
+            rte.value = ste->id;
+        }
     }
-    
-    fm->setContent(output.str(), output_file_name);
+    return !(pcrel && ste->local && ste->section == section->name); // erase uneccessary relocation records, field already holds the distance
 }
 
-vector<string> Assembler::divideEquOperands(string expression){
-    vector<string> ret = {};
-    if(expression[0]=='+' || expression[0]=='-'){
-        ret.push_back(string(1,expression[0]));
-        expression = expression.substr(1);
-    }
-    size_t next_operator_plus;
-    size_t next_operator_minus;
-    size_t next_operator;
-    while(1){
-        next_operator_plus = expression.find('+');
-        next_operator_minus = expression.find('-');
-        if(next_operator_plus == string::npos && next_operator_minus == string::npos){
-            next_operator = string::npos;
-            ret.push_back(expression);
-            break;
-        }
-        else if(next_operator_plus == string::npos && next_operator_minus != string::npos){
-            next_operator = next_operator_minus;
-        }
-        else if(next_operator_plus != string::npos && next_operator_minus == string::npos){
-            next_operator = next_operator_plus;
+void Assembler::writeObject(){
+    stringstream output;
+    {
+        PhaseTimer timer(stats, PHASE_FORMAT);
+        TraceScope trace_format("format output");
+        for(size_t i = 0; i < sections.size(); i++){
+            output<<"#.ret"<<sections[i]->name<<endl;
+            output<<relocation_texts[i]<<endl;
         }
-        else{
-            next_operator = next_operator_minus > next_operator_plus ? next_operator_plus : next_operator_minus;
+
+        output<<symbol_table_text;
+
+
+        output<<"MACHINE CODE:"<<endl;
+        for(size_t i = 0; i < sections.size(); i++){
+            output<<"#"<<sections[i]->name<<endl;
+            output<<machine_code_texts[i]<<endl;
         }
-        ret.push_back(expression.substr(0, next_operator));
-        ret.push_back(string(1, expression[next_operator]));
-        expression = expression.substr(next_operator+1);
+        output<<Section::getSectionFlags(sections);
+        if(line_table) output<<Section::getLineTables(sections);
+    }
+
+    {
+        PhaseTimer timer(stats, PHASE_WRITE);
+        TraceScope trace_write("FileManager::setContent");
+        fm->setContent(output.str(), output_file_name);
     }
-    return ret;
 }
 
 Assembler::~Assembler(){
     delete st;
     delete fm;
     delete tm;
-    sections.clear();
-    instruction_set.clear();
     for(Section* section: sections){
         delete section;
     }
+    sections.clear();
+    for(pair<const string, Section*>& spare: spare_sections) delete spare.second;
+    delete undefined_section;
+    delete recording;
+    instruction_set.clear();
     directive_map.clear();
 }
 
 void Assembler::resolveUST(){
-    int last = ust.size();
-    while(ust.size()>0){
-        for(vector<UncomputableSymbolTableEntry>:: iterator iter = ust.begin(); iter != ust.end();){
-            UncomputableSymbolTableEntry uste = *iter;
-            bool valid = true;
-            int offset = uste.offset;
-            vector<IndexTableEntry> index_table = uste.it;
-            //cout<<"SYM: "<<uste.left_symbol<<endl;
-            //int needed_symbols_resolved_count = 0;
-            for(vector<string>:: iterator itr = uste.needed_symbols.begin(); itr != uste.needed_symbols.end();){
-                string symbol = *itr;
-                int sign = symbol[0]=='1'? 1 : -1;
-                string symb = (sign == 1 ? symbol.substr(1) : symbol.substr(2));
-                SymbolTableEntry* found = st->findSymbol(symb);
-                if(found->section == "ABS") {
-                        offset += sign*found->offset;
-                        itr = uste.needed_symbols.erase(itr);
-                        continue;
-                };
-                if(found->defined == false) {
-                    itr++;
-                    continue;
-                }
-                itr = uste.needed_symbols.erase(itr);
-                offset += sign*found->offset;
-                string section = found->section;
-                vector<IndexTableEntry>::iterator it = std::find_if(index_table.begin(), index_table.end(), find_index_table_entry(section));
-                if(it != index_table.end()){
-                    it.base()->value += sign;
-                }    
-                else{
-                    index_table.push_back(*(new IndexTableEntry(found->section, sign)));
-                }
-            }
-            if(uste.needed_symbols.size() == 0){
-                int num = 0;
-                map<string, int> section_name_map = {};
-                for(IndexTableEntry ite: index_table){
-                    if (section_name_map.find(ite.section) != section_name_map.end()) section_name_map[ite.section] = 0;
-                    section_name_map[ite.section] += 1;
-                    if(ite.value != 0 && ite.value != 1) handleError("Illegal expression.");
-                    if(ite.value == 1 && num == 0) num = 1;
-                    else if(ite.value ==1 && num == 1) handleError("Illegal expression.");
-                }
-
-            // determin which section left symbol belongs to
-            string section_name="UND";
-            map<string, int>::iterator it;
-            int max_value = 0;
-            for ( it = section_name_map.begin(); it != section_name_map.end(); it++ ){
-                if(it->second > max_value) max_value = it->second;
-            }
-
-            for ( it = section_name_map.begin(); it != section_name_map.end(); it++ ){
-                if(it->second == max_value){
-                    section_name = it->first;
-                    break;
-                }
-            }
-                SymbolTableEntry* left = st->findSymbol(uste.left_symbol);
-                left->section = num==0 ? "ABS" : section_name;
-                left->defined = true;
-                left->offset = offset;
-                left->local = (left->section != "UND");
-                //if(num != 0) dealWithRelocationRecord(uste.left_symbol, 10, left->section); dont need reloc record for directive
-                iter = ust.erase(iter);
-                //cout<<"Defining: "<<uste.left_symbol<<endl;
-            }else { iter++; }
+    // worklist instead of sweeping ust until nothing changes: an entry is looked at again
+    // only when the symbol it was waiting for gets defined
+    unordered_map<string, vector<size_t>> waiting = {};
+    vector<size_t> ready = {};
+    for(size_t i = ust.size(); i > 0; i--) ready.push_back(i-1);
+    size_t resolved = 0;
+    while(ready.size()>0){
+        size_t i = ready.back();
+        ready.pop_back();
+        string missing = "";
+        if(!resolveUSTEntry(ust[i], missing)){
+            waiting[missing].push_back(i);
+            continue;
         }
-        if(last == ust.size()) handleError("Cannot resolve .equ dependencies.");
-        last = ust.size();
+        resolved++;
+        unordered_map<string, vector<size_t>>::iterator it = waiting.find(ust[i].left_symbol);
+        if(it == waiting.end()) continue;
+        ready.insert(ready.end(), it->second.begin(), it->second.end());
+        waiting.erase(it);
+    }
+    if(resolved != ust.size()) handleError("Cannot resolve .equ dependencies.");
+    ust.clear();
+}
+
+bool Assembler::resolveUSTEntry(UncomputableSymbolTableEntry& entry, string& missing){
+    ExpressionValue value;
+    if(!entry.expression.evaluate(st, BIND_SECTIONS, value, missing)){
+        if(missing != "") return false;
+        handleError(entry.expression.error);
+    }
+    // relocatable in at most one section, or absolute when they all cancel out
+    if(value.terms.size() > 1 || (value.terms.size() == 1 && value.terms[0].coefficient != 1)) handleError("Illegal expression.");
+    string section = value.terms.empty() ? "ABS" : value.terms[0].base;
+    SymbolTableEntry* left = st->findSymbol(entry.left_symbol);
+    if(left == nullptr){
+        st->addSymbol(SymbolTableEntry(entry.left_symbol, section, value.constant, section != "ABS", true, false));
+        return true;
     }
+    left->section = section;
+    left->defined = true;
+    left->offset = value.constant;
+    left->local = (left->section != "UND");
+    //if(num != 0) dealWithRelocationRecord(uste.left_symbol, 10, left->section); dont need reloc record for directive
+    return true;
 }
 
 // newest version
\ No newline at end of file
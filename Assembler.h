@@ -5,32 +5,76 @@
 #include "TextManipulator.h"
 #include "SymbolTable.h"
 #include "Section.h"
+#include "Statistics.h"
+#include "Tracer.h"
+#include "Expression.h"
+#include "IncludeCache.h"
 #include <map>
+#include <unordered_map>
 
-struct IndexTableEntry{
-    string section;
-    int value;
+#define ASSEMBLER_VERSION "1.5" // part of the object cache key, bump it with every change of the output
+#define TRACE_CHUNK_LINES 4096 // source lines per span in --trace output
+#define MAX_MACRO_DEPTH 64 // nested macro/.rept expansions before giving up, catches recursive macros
+#define MACRO_COUNTER -2 // MacroSegment parameter for \@
 
-    IndexTableEntry(string s, int v=0):section(s),value(v){}
+struct UncomputableSymbolTableEntry {
+    string left_symbol;
+    Expression expression; // compiled once, evaluated again only when the symbol it stopped at gets defined
+
+    UncomputableSymbolTableEntry(string l):left_symbol(l){}
 };
 
-struct find_index_table_entry : std::unary_function<IndexTableEntry, bool> {
-    string section;
-    find_index_table_entry(string s):section(s) { }
-    bool operator()(IndexTableEntry const& i) const {
-        return i.section == section;
-    }
+/*
+    Macro bodies are lexed once, when they are defined. Every token is split into
+    segments of plain text and parameter references (\param, \@), so expanding a
+    macro only concatenates segments and never lexes text again.
+*/
+struct MacroSegment{
+    string text;
+    int parameter; // index in Macro::parameters, -1 for plain text, MACRO_COUNTER for \@
+
+    MacroSegment(string t, int p=-1):text(t), parameter(p){}
 };
 
-struct UncomputableSymbolTableEntry {
-    string left_symbol;
-    vector<string> needed_symbols;
-    vector<IndexTableEntry> it;
-    int offset;
+struct MacroLine{
+    int line; // source line of the body line, for error messages
+    vector<vector<MacroSegment>> tokens;
 
-    UncomputableSymbolTableEntry(string l, vector<IndexTableEntry> i):left_symbol(l), it(i), offset(0){
-        needed_symbols = {};
-    }
+    MacroLine(int l):line(l){}
+};
+
+struct Macro{
+    string name; // .rept for repeat blocks
+    int line; // line of the .macro/.rept directive
+    vector<string> parameters;
+    vector<string> defaults; // empty when the argument is required
+    vector<MacroLine> body;
+
+    Macro(string n, int l):name(n), line(l){}
+};
+
+struct MacroFrame{
+    string name;
+    int line; // body line being expanded
+    MacroFrame(string n, int l):name(n), line(l){}
+};
+
+struct IncludeFrame{
+    string path; // canonical, for cycle detection
+    string name; // as written in .include
+    int line; // line of the included file being processed
+    size_t macro_depth; // expansions open when the file was included, orders include and macro frames in errors
+
+    IncludeFrame(string p, string n, size_t d):path(p), name(n), line(0), macro_depth(d){}
+};
+
+struct Conditional{
+    int line; // line of the .if, for errors
+    bool active; // lines of the current branch are assembled
+    bool taken; // some branch was already active, .else stays inactive
+    bool in_else;
+
+    Conditional(int l, bool a):line(l), active(a), taken(a), in_else(false){}
 };
 
 struct Instruction{
@@ -40,6 +84,14 @@ struct Instruction{
     Instruction(string n, int oc, int on): name(n), OC(oc), operand_number(on){};
 };
 
+struct SourceLine{
+    Section* section; // section of the instruction on the line, null for every other line
+    int offset;
+    int length;
+    int first_id; // SymbolTableEntry::global_id before the line, ids follow the first mention of a symbol
+    SourceLine(Section* s, int o, int l, int f):section(s), offset(o), length(l), first_id(f){}
+};
+
 struct find_instruction : std::unary_function<Instruction, bool> {
     string name;
     find_instruction(string n):name(n) { }
@@ -65,22 +117,58 @@ class Assembler{
         string output_file_name;
         vector<string> assembly_code;
         vector<Section*> sections;
+        unordered_map<string, Section*> section_index; // name -> section, same order of magnitude as symbol lookups
+        unordered_map<string, Section*> spare_sections; // sections of earlier runs, reused by name after reset()
+        Section* undefined_section; // UND, current before the first .section
         vector<Instruction> instruction_set;
         vector<UncomputableSymbolTableEntry> ust; // used for equ directives
         int line_of_code;
+        bool finished; // .end reached
         Section* current_section;
         map<string, int> directive_map;
+        Statistics* stats; // null unless --stats is given
+        unordered_map<string, Macro> macros;
+        Macro* recording; // .macro/.rept whose body is being read, null otherwise
+        int recording_depth; // nested definitions inside the recorded body
+        int rept_count; // -1 when recording a .macro
+        vector<MacroFrame> expansion_stack;
+        int macro_counter; // value of \@, incremented on every expansion
+        vector<IncludeFrame> include_stack;
+        vector<Conditional> conditionals; // open .if blocks, only pushed while assembling
+        int skipped_depth; // .if blocks opened inside a skipped branch
+        string prelude_file; // snapshot loaded before the first line, empty for none
+        bool emit_prelude; // end() writes a symbol snapshot instead of an object
+        bool line_table; // -g, sections record which source line their code comes from
+        vector<SourceLine> source_lines; // one per input line up to .end, where patch() puts the code of an edited line
+        vector<string> relocation_texts; // formatted parts of the last object, patch() redoes only the sections it changes
+        vector<string> machine_code_texts;
+        string symbol_table_text;
 
         vector<char> processOneLine(string line); // one line assembly ==> one line binary
-        vector<char> dealWithInstruction(string instruction); // recognize given instruction and return binary code for given instruction
-        void dealWithDirective(string directive); // recognize given directive and do stuff
+        vector<string> lexLine(string line); // label, mnemonic/directive and operands, comments dropped
+        vector<char> processTokens(vector<string>& tokens); // one lexed line ==> one line binary
+        vector<char> dealWithInstruction(vector<string>& words); // recognize given instruction and return binary code for given instruction
+        void dealWithDirective(vector<string>& words); // recognize given directive (words[0] without the dot) and do stuff
+        int sourceLine(); // line being processed, inside a macro the body line, inside an included file its line
+        bool skipping(){ return !conditionals.empty() && !conditionals.back().active; }
+        void skipLine(const string& line); // finds conditional directives in a skipped line without lexing it
+        void skipDirective(const char* name, size_t length); // conditional nesting inside a skipped branch
+        void dealWithConditional(vector<string>& words); // .if/.ifdef/.ifndef/.else/.endif on an assembled line
+        void enterElse(); // innermost .if switches to its .else branch
+        int evaluateCondition(vector<string>& words); // .if operand, a constant expression
+        void recordLine(vector<string>& tokens); // adds a line to the macro/.rept being defined
+        static vector<MacroSegment> compileMacroToken(const string& token, const vector<string>& parameters);
+        void finishRecording(); // stores the macro, or expands the .rept block
+        void expandMacro(Macro& macro, vector<string> arguments);
         void defineSymbol(string symbol, bool local, bool defined, bool ext=false); // symbol table etc.. logic
         void dealWithComment(string comment); // probably ignore given comment, needed for testing
         SymbolTableEntry* dealWithSymbol(string symbolName, int address_field_offset, int end_of_instruction=0, bool pcrel=false); // deal with situation when symbol is found in a address field
+        short symbolField(string symbol_name, int address_field_offset, int register_num, int end_of_instruction, int addend); // value of an operand field naming a symbol, forward reference and relocation included
+        void foldOperand(string& operand, int& addend); // operand expression ==> literal, or symbol and addend
         void dealWithSection(string section_name); // sets current section
         void dealWithRelocationRecord(string symbol, int instruction_offset, int reg_num=10, string section=""); // will be called after dealing with a symbol inside of an instruction
 
-        Section* findSection(string section); // finds section with given name
+        Section* findSection(string section); // finds section with given name, the leading dot is optional
 
         string handleError(string error); // maybe create some error table and then return int as a code to take a specific message for output
 
@@ -88,18 +176,34 @@ class Assembler{
         static int determineRegister(string operand); // get register number if one is used from operand
         static char higherByteRegister(string operand); // is higher 8 or lower 8 bits used for register direct addressing mode: 0-lower, 1-higher
 
+        void loadPrelude(); // maps prelude_file into the symbol table
+        string resolveIncluded(string file_name); // canonical path of an .include/.incbin name, looked up next to the including file first
+        void includeFile(string file_name); // .include, assembles the lines of another source file in place
+        void includeBinary(string file_name, long long offset, long long length); // .incbin, length -1 means up to the end of the file
+        static bool parseLiteral(const string& x, int& value); // numeric literal without symbol lookups, false if x is anything else
+        bool appendLiterals(const vector<string>& words, int size); // .byte/.word line made only of literals, false if the slow path is needed
+
         int getInt(string operand);
         bool isSymbol(string x);
         map<string, int> createMap();
         void end();
+        void formatSection(Section* section, string& relocation_table, string& machine_code); // backpatch, finalize relocations and format one section, safe to run concurrently for different sections
+        bool finalizeRelocation(RelocationTableEntry& rte, Section* section); // points a relocation at its symbol, false when the field needs none
+        void writeObject(); // object file from the formatted sections and the symbol table
+        bool mentionsOnlyEarlier(const vector<string>& tokens, int first_id); // operands of an instruction are literals, registers or symbols with ids below first_id
 
         void resolveUST();
-
-        vector<string> divideEquOperands(string expression);
+        bool resolveUSTEntry(UncomputableSymbolTableEntry& entry, string& missing); // defines left symbol, or returns false and the first undefined symbol
     public: 
         Assembler(string ifn, string ofn);
         ~Assembler();
-        int start();
+        void reset(string ifn, string ofn); // ready for another input, keeps the options and the capacity of tables and section buffers
+        void setStatistics(Statistics* stats);
+        void setPrelude(string snapshot_file); // symbols of an --emit-prelude run are known before the first line
+        void setEmitPrelude(bool emit); // output is a snapshot of .equ constants and externs, sections are an error
+        void setLineTable(bool enabled); // adds a LINE TABLE part to the object
+        int start(); // 0 when the object file was written, -1 if there was no .end
+        bool patch(); // after start() wrote an object, reassembles only the instruction lines edited since and rewrites it, false when an edit needs reset() and start()
 };
 
 #endif
\ No newline at end of file
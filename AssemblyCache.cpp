@@ -0,0 +1,216 @@
+#include "AssemblyCache.h"
+#include "Assembler.h"
+#include <algorithm>
+#include <sstream>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+AssemblyCache::AssemblyCache(string dir, unsigned long long max_size){
+    directory = dir;
+    this->max_size = max_size;
+    mkdir(directory.c_str(), 0777);
+}
+
+string AssemblyCache::defaultDirectory(){
+    const char* env = getenv("ASSEMBLER_CACHE_DIR");
+    if(env != nullptr && env[0] != '\0') return env;
+    const char* home = getenv("HOME");
+    if(home == nullptr) return ".assembler_cache";
+    string cache = string(home) + "/.cache";
+    mkdir(cache.c_str(), 0777);
+    return cache + "/assembler";
+}
+
+bool AssemblyCache::parseSize(string text, unsigned long long& size){
+    if(text.empty()) return false;
+    unsigned long long multiplier = 1;
+    switch(text[text.size()-1]){
+        case 'k': case 'K': multiplier = 1024ULL; break;
+        case 'm': case 'M': multiplier = 1024ULL*1024; break;
+        case 'g': case 'G': multiplier = 1024ULL*1024*1024; break;
+    }
+    if(multiplier != 1) text = text.substr(0, text.size()-1);
+    if(text.empty() || !isdigit(text[0])) return false; // strtoull would take blanks and a sign
+    char* end;
+    errno = 0;
+    unsigned long long value = strtoull(text.c_str(), &end, 10);
+    if(*end != '\0' || errno == ERANGE || value > ULLONG_MAX / multiplier) return false;
+    size = value * multiplier;
+    return true;
+}
+
+// two FNV-1a passes with different offset bases give a 128 bit key
+static void hashBytes(const char* data, size_t n, unsigned long long* h1, unsigned long long* h2){
+    for(size_t i = 0; i < n; i++){
+        *h1 = (*h1 ^ (unsigned char)data[i]) * 0x100000001b3ULL;
+        *h2 = (*h2 ^ (unsigned char)data[i]) * 0x100000001b3ULL;
+    }
+}
+
+string AssemblyCache::computeKey(string input_file_name, string options){
+    ifstream input(input_file_name, ios::in | ios::binary);
+    if(input.is_open()==false) return "";
+    unsigned long long h1 = 0xcbf29ce484222325ULL, h2 = 0x84222325cbf29ce4ULL;
+    string header = string(ASSEMBLER_VERSION) + '\0' + options + '\0';
+    // a rebuilt assembler may write other objects even if nobody bumped the version
+    struct stat binary;
+    if(stat("/proc/self/exe", &binary) == 0) header += to_string(binary.st_size) + ':' + to_string(binary.st_mtim.tv_sec) + '.' + to_string(binary.st_mtim.tv_nsec) + '\0';
+    hashBytes(header.data(), header.size(), &h1, &h2);
+    vector<char> buffer(1<<16);
+    const string included = ".inc"; // .incbin and .include
+    string tail = ""; // end of the previous block, for directives split between blocks
+    while(input.read(buffer.data(), buffer.size()) || input.gcount() > 0){
+        hashBytes(buffer.data(), input.gcount(), &h1, &h2);
+        // embedded files are not covered by the key, so such sources are never cached
+        string window = tail + string(buffer.data(), min((size_t)input.gcount(), included.size()-1));
+        if(window.find(included) != string::npos) return "";
+        if(search(buffer.data(), buffer.data() + input.gcount(), included.begin(), included.end()) != buffer.data() + input.gcount()) return "";
+        tail = string(buffer.data() + input.gcount() - min((size_t)input.gcount(), included.size()-1), buffer.data() + input.gcount());
+    }
+    char key[33];
+    snprintf(key, sizeof(key), "%016llx%016llx", h1, h2);
+    return key;
+}
+
+string AssemblyCache::entryPath(string key){
+    return directory + "/" + key.substr(0, 2) + "/" + key;
+}
+
+int AssemblyCache::lockStatistics(CacheStatistics& cs){
+    int fd = open((directory + "/stats").c_str(), O_RDWR | O_CREAT, 0666);
+    if(fd < 0) return -1;
+    flock(fd, LOCK_EX);
+    char buffer[256];
+    ssize_t n = pread(fd, buffer, sizeof(buffer)-1, 0);
+    buffer[n > 0 ? n : 0] = '\0';
+    stringstream ss(buffer);
+    string name;
+    long long value;
+    while(ss >> name >> value){
+        if(name == "hits") cs.hits = value;
+        else if(name == "misses") cs.misses = value;
+        else if(name == "size") cs.size = value;
+        else if(name == "files") cs.files = value;
+    }
+    return fd;
+}
+
+void AssemblyCache::unlockStatistics(int fd, CacheStatistics& cs){
+    string content = "hits " + to_string(cs.hits) + "\nmisses " + to_string(cs.misses) +
+        "\nsize " + to_string(cs.size) + "\nfiles " + to_string(cs.files) + "\n";
+    if(ftruncate(fd, 0) == 0 && pwrite(fd, content.data(), content.size(), 0) < 0){
+        cerr<<"Cache statistics in "<<directory<<" cannot be written"<<endl;
+    }
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+bool AssemblyCache::copyFile(string from, string to){
+    ifstream in(from, ios::in | ios::binary);
+    if(in.is_open()==false) return false;
+    ofstream out(to, ios::out | ios::binary | ios::trunc);
+    if(out.is_open()==false) return false;
+    out << in.rdbuf();
+    return out.good();
+}
+
+bool AssemblyCache::fetch(string key, string output_file_name){
+    string path = entryPath(key);
+    bool hit = copyFile(path, output_file_name);
+    if(hit) utime(path.c_str(), nullptr); // mtime is the LRU timestamp
+    CacheStatistics cs;
+    int fd = lockStatistics(cs);
+    if(fd < 0) return hit;
+    if(hit) cs.hits++;
+    else cs.misses++;
+    unlockStatistics(fd, cs);
+    return hit;
+}
+
+void AssemblyCache::store(string key, string output_file_name){
+    string path = entryPath(key);
+    mkdir((directory + "/" + key.substr(0, 2)).c_str(), 0777);
+    string temporary = path + ".tmp." + to_string(getpid());
+    if(!copyFile(output_file_name, temporary)){
+        unlink(temporary.c_str());
+        return;
+    }
+    // the lock is held from looking at the old entry until the counters are written,
+    // otherwise two stores of the same key would both count it as a new file
+    CacheStatistics cs;
+    int fd = lockStatistics(cs);
+    struct stat old_entry, new_entry;
+    bool replaced = stat(path.c_str(), &old_entry) == 0;
+    stat(temporary.c_str(), &new_entry);
+    if(rename(temporary.c_str(), path.c_str()) != 0){
+        unlink(temporary.c_str());
+        if(fd >= 0) unlockStatistics(fd, cs);
+        return;
+    }
+    if(fd < 0) return;
+    cs.size += new_entry.st_size - (replaced ? old_entry.st_size : 0);
+    if(!replaced) cs.files++;
+    if((unsigned long long)cs.size > max_size) evict(cs);
+    unlockStatistics(fd, cs);
+}
+
+struct CacheEntry{
+    string path;
+    long long last_use; // mtime in nanoseconds
+    long long size;
+
+    CacheEntry(string p, long long t, long long s):path(p), last_use(t), size(s){}
+};
+
+void AssemblyCache::evict(CacheStatistics& cs){
+    // counters can drift when entries are removed by hand, so recount while scanning
+    vector<CacheEntry> entries = {};
+    cs.size = 0;
+    DIR* root = opendir(directory.c_str());
+    if(root == nullptr) return;
+    for(dirent* sub = readdir(root); sub != nullptr; sub = readdir(root)){
+        if(strlen(sub->d_name) != 2 || sub->d_name[0] == '.') continue;
+        string sub_path = directory + "/" + sub->d_name;
+        DIR* d = opendir(sub_path.c_str());
+        if(d == nullptr) continue;
+        for(dirent* e = readdir(d); e != nullptr; e = readdir(d)){
+            if(e->d_name[0] == '.' || strstr(e->d_name, ".tmp.") != nullptr) continue;
+            string path = sub_path + "/" + e->d_name;
+            struct stat st;
+            if(stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+            entries.push_back(CacheEntry(path, st.st_mtim.tv_sec*1000000000LL + st.st_mtim.tv_nsec, st.st_size));
+            cs.size += st.st_size;
+        }
+        closedir(d);
+    }
+    closedir(root);
+    sort(entries.begin(), entries.end(), [](const CacheEntry& a, const CacheEntry& b){ return a.last_use < b.last_use; });
+    unsigned long long limit = max_size / 10 * 9;
+    size_t i = 0;
+    for(; i < entries.size() && (unsigned long long)cs.size > limit; i++){
+        if(unlink(entries[i].path.c_str()) == 0) cs.size -= entries[i].size;
+    }
+    cs.files = entries.size() - i;
+}
+
+string AssemblyCache::statistics(){
+    CacheStatistics cs;
+    int fd = lockStatistics(cs);
+    if(fd >= 0) unlockStatistics(fd, cs);
+    long long lookups = cs.hits + cs.misses;
+    stringstream ss;
+    ss<<"cache directory: "<<directory<<endl;
+    ss<<"hits:            "<<cs.hits<<endl;
+    ss<<"misses:          "<<cs.misses<<endl;
+    ss<<"hit rate:        "<<(lookups ? cs.hits*100/lookups : 0)<<"%"<<endl;
+    ss<<"files:           "<<cs.files<<endl;
+    ss<<"size:            "<<cs.size<<" / "<<max_size<<" bytes"<<endl;
+    return ss.str();
+}
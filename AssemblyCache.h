@@ -0,0 +1,48 @@
+#ifndef ASSEMBLYCACHE_H
+#define ASSEMBLYCACHE_H
+
+#include "INCLUDES.h"
+#include <vector>
+
+struct CacheStatistics{
+    long long hits;
+    long long misses;
+    long long size; // bytes in stored objects
+    long long files;
+
+    CacheStatistics():hits(0), misses(0), size(0), files(0){}
+};
+
+/*
+    Content addressed cache of object files. Key is a hash of the input bytes,
+    assembler version and output affecting options. Entries are stored as
+    <directory>/<first two key chars>/<key>, written to a temporary file first
+    and renamed into place so concurrent builds can share one directory.
+    Counters live in <directory>/stats, which is only touched while holding
+    an flock on it.
+*/
+class AssemblyCache{
+    private:
+        string directory;
+        unsigned long long max_size;
+
+        string entryPath(string key);
+        int lockStatistics(CacheStatistics& cs); // returns locked descriptor, -1 on failure
+        void unlockStatistics(int fd, CacheStatistics& cs); // writes counters back and releases the lock
+        void evict(CacheStatistics& cs); // removes least recently used entries until size drops under 90% of max_size
+        static bool copyFile(string from, string to);
+    public:
+        static const unsigned long long DEFAULT_SIZE = 512ULL*1024*1024;
+
+        AssemblyCache(string dir, unsigned long long max_size=DEFAULT_SIZE);
+
+        string computeKey(string input_file_name, string options); // empty if input can't be read or uses .incbin/.include
+        bool fetch(string key, string output_file_name); // on hit copies stored object to output
+        void store(string key, string output_file_name);
+        string statistics();
+
+        static string defaultDirectory();
+        static bool parseSize(string text, unsigned long long& size); // accepts K, M and G suffixes, false if text isn't a size
+};
+
+#endif
@@ -0,0 +1,300 @@
+#include "Expression.h"
+
+static bool parseNumber(const string& x, int& value){
+    // same bases as Assembler::getInt: 0x hex, 0b binary, leading 0 octal, decimal
+    int base = 10;
+    size_t i = 0;
+    if(x.size() > 1 && x[0] == '0'){
+        if(x[1] == 'x' || x[1] == 'X') base = 16, i = 2;
+        else if(x[1] == 'b' || x[1] == 'B') base = 2, i = 2;
+        else base = 8, i = 1;
+        if(i == x.size()) return false;
+    }
+    unsigned int v = 0;
+    for(; i < x.size(); i++){
+        char c = x[i];
+        int digit = isdigit(c) ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+        if(digit < 0 || digit >= base) return false;
+        v = v * base + digit;
+    }
+    value = v;
+    return true;
+}
+
+static bool apply(unsigned char opcode, int left, int right, int& result){
+    // unsigned arithmetic wraps like the 16 bit fields the values end up in
+    switch(opcode){
+        case EXPR_NEGATE: result = -(unsigned int)left; break;
+        case EXPR_COMPLEMENT: result = ~left; break;
+        case EXPR_NOT: result = !left; break;
+        case EXPR_MULTIPLY: result = (unsigned int)left * (unsigned int)right; break;
+        case EXPR_DIVIDE:
+            if(right == 0) return false;
+            result = (long long)left / right; // INT_MIN/-1 overflows int, wraps to INT_MIN
+            break;
+        case EXPR_MODULO:
+            if(right == 0) return false;
+            result = (long long)left % right;
+            break;
+        case EXPR_ADD: result = (unsigned int)left + (unsigned int)right; break;
+        case EXPR_SUBTRACT: result = (unsigned int)left - (unsigned int)right; break;
+        case EXPR_SHIFT_LEFT: result = (unsigned int)left << (right & 31); break;
+        case EXPR_SHIFT_RIGHT: result = left >> (right & 31); break;
+        case EXPR_LESS: result = left < right; break;
+        case EXPR_LESS_EQUAL: result = left <= right; break;
+        case EXPR_GREATER: result = left > right; break;
+        case EXPR_GREATER_EQUAL: result = left >= right; break;
+        case EXPR_EQUAL: result = left == right; break;
+        case EXPR_NOT_EQUAL: result = left != right; break;
+        case EXPR_AND: result = left & right; break;
+        case EXPR_XOR: result = left ^ right; break;
+        case EXPR_OR: result = left | right; break;
+        case EXPR_LOGICAL_AND: result = left && right; break;
+        case EXPR_LOGICAL_OR: result = left || right; break;
+    }
+    return true;
+}
+
+static void addTerms(vector<ExpressionTerm>& to, const vector<ExpressionTerm>& from, int factor){
+    for(const ExpressionTerm& term: from){
+        size_t i = 0;
+        while(i < to.size() && to[i].base != term.base) i++;
+        if(i == to.size()) to.push_back(ExpressionTerm(term.base, 0));
+        to[i].coefficient = (unsigned int)to[i].coefficient + (unsigned int)factor * (unsigned int)term.coefficient; // wraps like apply()
+        if(to[i].coefficient == 0) to.erase(to.begin() + i);
+    }
+}
+
+bool Expression::fail(string message){
+    error = message;
+    return false;
+}
+
+void Expression::skipBlanks(){
+    while(at < text.size() && (text[at] == ' ' || text[at] == '\t')) at++;
+}
+
+bool Expression::compile(const string& expression, SymbolTable* st){
+    text = expression;
+    at = 0;
+    program.clear();
+    symbols.clear();
+    error = "";
+    if(!parseBinary(1, st)) return false;
+    skipBlanks();
+    if(at != text.size()) return fail("Unexpected " + text.substr(at) + " in expression " + text + ".");
+    return true;
+}
+
+int Expression::binaryOperator(unsigned char& opcode, size_t& length){
+    if(at >= text.size()) return 0;
+    char next = at + 1 < text.size() ? text[at + 1] : 0;
+    length = 1;
+    switch(text[at]){
+        case '*': opcode = EXPR_MULTIPLY; return 10;
+        case '/': opcode = EXPR_DIVIDE; return 10;
+        case '%': opcode = EXPR_MODULO; return 10;
+        case '+': opcode = EXPR_ADD; return 9;
+        case '-': opcode = EXPR_SUBTRACT; return 9;
+        case '<':
+            if(next == '<'){ length = 2; opcode = EXPR_SHIFT_LEFT; return 8; }
+            if(next == '='){ length = 2; opcode = EXPR_LESS_EQUAL; return 7; }
+            opcode = EXPR_LESS;
+            return 7;
+        case '>':
+            if(next == '>'){ length = 2; opcode = EXPR_SHIFT_RIGHT; return 8; }
+            if(next == '='){ length = 2; opcode = EXPR_GREATER_EQUAL; return 7; }
+            opcode = EXPR_GREATER;
+            return 7;
+        case '=':
+            if(next != '=') return 0;
+            length = 2;
+            opcode = EXPR_EQUAL;
+            return 6;
+        case '!':
+            if(next != '=') return 0;
+            length = 2;
+            opcode = EXPR_NOT_EQUAL;
+            return 6;
+        case '&':
+            if(next == '&'){ length = 2; opcode = EXPR_LOGICAL_AND; return 2; }
+            opcode = EXPR_AND;
+            return 5;
+        case '^': opcode = EXPR_XOR; return 4;
+        case '|':
+            if(next == '|'){ length = 2; opcode = EXPR_LOGICAL_OR; return 1; }
+            opcode = EXPR_OR;
+            return 3;
+    }
+    return 0;
+}
+
+bool Expression::parseBinary(int min_precedence, SymbolTable* st){
+    // precedence climbing, operators of equal precedence are left associative
+    size_t left_start = program.size();
+    if(!parseUnary(st)) return false;
+    while(1){
+        skipBlanks();
+        unsigned char opcode;
+        size_t length;
+        int precedence = binaryOperator(opcode, length);
+        if(precedence < min_precedence) return true;
+        at += length;
+        size_t right_start = program.size();
+        if(!parseBinary(precedence + 1, st)) return false;
+        emitBinary(opcode, left_start, right_start);
+        if(error != "") return false;
+    }
+}
+
+bool Expression::parseUnary(SymbolTable* st){
+    skipBlanks();
+    if(at < text.size() && (text[at] == '-' || text[at] == '+' || text[at] == '~' || text[at] == '!')){
+        char c = text[at++];
+        size_t start = program.size();
+        if(!parseUnary(st)) return false;
+        if(c != '+') emitUnary(c == '-' ? EXPR_NEGATE : c == '~' ? EXPR_COMPLEMENT : EXPR_NOT, start);
+        return true;
+    }
+    return parsePrimary(st);
+}
+
+bool Expression::parsePrimary(SymbolTable* st){
+    skipBlanks();
+    if(at >= text.size()) return fail("Missing operand in expression " + text + ".");
+    char c = text[at];
+    if(c == '('){
+        at++;
+        if(!parseBinary(1, st)) return false;
+        skipBlanks();
+        if(at >= text.size() || text[at] != ')') return fail("Missing ) in expression " + text + ".");
+        at++;
+        return true;
+    }
+    if(c == '\''){
+        if(at + 2 >= text.size() || text[at + 2] != '\'') return fail("Bad character literal in expression " + text + ".");
+        program.push_back(ExpressionOp(EXPR_CONSTANT, text[at + 1]));
+        at += 3;
+        return true;
+    }
+    size_t start = at;
+    if(isdigit(c)){
+        while(at < text.size() && isalnum(text[at])) at++;
+        int value;
+        if(!parseNumber(text.substr(start, at - start), value)) return fail("Bad number " + text.substr(start, at - start) + " in expression " + text + ".");
+        program.push_back(ExpressionOp(EXPR_CONSTANT, value));
+        return true;
+    }
+    if(!isalpha(c) && c != '_' && c != '.') return fail("Unexpected " + text.substr(at) + " in expression " + text + ".");
+    while(at < text.size() && (isalnum(text[at]) || text[at] == '_' || text[at] == '.')) at++;
+    string name = text.substr(start, at - start);
+    if(st != nullptr){
+        SymbolTableEntry* found = st->findSymbol(name);
+        if(found != nullptr && found->defined && found->section == "ABS"){
+            program.push_back(ExpressionOp(EXPR_CONSTANT, found->offset));
+            return true;
+        }
+    }
+    size_t index = 0;
+    while(index < symbols.size() && symbols[index] != name) index++;
+    if(index == symbols.size()) symbols.push_back(name);
+    program.push_back(ExpressionOp(EXPR_SYMBOL, index));
+    return true;
+}
+
+void Expression::emitUnary(unsigned char opcode, size_t start){
+    if(program.size() == start + 1 && program[start].opcode == EXPR_CONSTANT){
+        apply(opcode, program[start].value, 0, program[start].value);
+        return;
+    }
+    program.push_back(ExpressionOp(opcode));
+}
+
+void Expression::emitBinary(unsigned char opcode, size_t left_start, size_t right_start){
+    bool right_constant = program.size() == right_start + 1 && program[right_start].opcode == EXPR_CONSTANT;
+    if(right_constant && right_start == left_start + 1 && program[left_start].opcode == EXPR_CONSTANT){
+        if(!apply(opcode, program[left_start].value, program[right_start].value, program[left_start].value)) fail("Division by zero in expression " + text + ".");
+        program.pop_back();
+        return;
+    }
+    // x+2+3 is (x+2)+3: add the constant to the one the left operand ends with
+    bool additive = opcode == EXPR_ADD || opcode == EXPR_SUBTRACT;
+    if(additive && right_constant && right_start >= left_start + 3 && program[right_start - 2].opcode == EXPR_CONSTANT
+        && (program[right_start - 1].opcode == EXPR_ADD || program[right_start - 1].opcode == EXPR_SUBTRACT)){
+        int left = program[right_start - 1].opcode == EXPR_ADD ? program[right_start - 2].value : -program[right_start - 2].value;
+        int sum = left + (opcode == EXPR_ADD ? program[right_start].value : -program[right_start].value);
+        program.pop_back();
+        if(sum == 0){
+            program.erase(program.begin() + (right_start - 2), program.end());
+            return;
+        }
+        program[right_start - 2].value = sum;
+        program[right_start - 1].opcode = EXPR_ADD;
+        return;
+    }
+    if(additive && right_constant && program[right_start].value == 0){
+        program.pop_back();
+        return;
+    }
+    program.push_back(ExpressionOp(opcode));
+}
+
+bool Expression::evaluate(SymbolTable* st, ExpressionBinding binding, ExpressionValue& result, string& missing){
+    error = "";
+    vector<ExpressionValue> stack = {};
+    stack.reserve(program.size());
+    for(const ExpressionOp& op: program){
+        if(op.opcode == EXPR_CONSTANT){
+            stack.push_back(ExpressionValue(op.value));
+            continue;
+        }
+        if(op.opcode == EXPR_SYMBOL){
+            const string& name = symbols[op.value];
+            SymbolTableEntry* found = st->findSymbol(name);
+            ExpressionValue value;
+            if(found != nullptr && found->defined && found->section == "ABS") value.constant = found->offset;
+            else if(binding == BIND_SYMBOLS) value.terms.push_back(ExpressionTerm(name, 1));
+            else if(found != nullptr && found->defined){
+                value.constant = found->offset;
+                value.terms.push_back(ExpressionTerm(found->section, 1));
+            }
+            else if(found != nullptr && found->externn) value.terms.push_back(ExpressionTerm("UND", 1));
+            else{
+                missing = name;
+                return false; // nothing is kept, the caller evaluates again once the symbol is defined
+            }
+            stack.push_back(value);
+            continue;
+        }
+        if(op.opcode <= EXPR_NOT){
+            ExpressionValue& value = stack.back();
+            if(op.opcode == EXPR_NEGATE){
+                for(ExpressionTerm& term: value.terms) term.coefficient = -term.coefficient;
+            }else if(!value.terms.empty()) return fail("Illegal expression.");
+            apply(op.opcode, value.constant, 0, value.constant);
+            continue;
+        }
+        ExpressionValue right = stack.back();
+        stack.pop_back();
+        ExpressionValue& left = stack.back();
+        if(op.opcode == EXPR_ADD || op.opcode == EXPR_SUBTRACT){
+            int sign = op.opcode == EXPR_ADD ? 1 : -1;
+            addTerms(left.terms, right.terms, sign);
+            apply(op.opcode, left.constant, right.constant, left.constant);
+            continue;
+        }
+        if(op.opcode == EXPR_MULTIPLY && (left.terms.empty() || right.terms.empty())){
+            // scaling is linear, 2*label-label is still label
+            if(left.terms.empty()) swap(left, right);
+            vector<ExpressionTerm> terms = {};
+            addTerms(terms, left.terms, right.constant);
+            left.terms = terms;
+            left.constant = (unsigned int)left.constant * (unsigned int)right.constant;
+            continue;
+        }
+        if(!left.terms.empty() || !right.terms.empty()) return fail("Illegal expression.");
+        if(!apply(op.opcode, left.constant, right.constant, left.constant)) return fail("Division by zero in expression " + text + ".");
+    }
+    result = stack.back();
+    return true;
+}
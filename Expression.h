@@ -0,0 +1,84 @@
+#ifndef EXPRESSION_H
+#define EXPRESSION_H
+
+#include "INCLUDES.h"
+#include "SymbolTable.h"
+#include <vector>
+
+enum ExpressionOpcode{
+    EXPR_CONSTANT,
+    EXPR_SYMBOL,
+    EXPR_NEGATE, EXPR_COMPLEMENT, EXPR_NOT, // unary -, ~, !
+    EXPR_MULTIPLY, EXPR_DIVIDE, EXPR_MODULO,
+    EXPR_ADD, EXPR_SUBTRACT,
+    EXPR_SHIFT_LEFT, EXPR_SHIFT_RIGHT,
+    EXPR_LESS, EXPR_LESS_EQUAL, EXPR_GREATER, EXPR_GREATER_EQUAL,
+    EXPR_EQUAL, EXPR_NOT_EQUAL,
+    EXPR_AND, EXPR_XOR, EXPR_OR,
+    EXPR_LOGICAL_AND, EXPR_LOGICAL_OR
+};
+
+struct ExpressionOp{
+    unsigned char opcode;
+    int value; // the number for EXPR_CONSTANT, index in Expression::symbols for EXPR_SYMBOL
+
+    ExpressionOp(unsigned char o, int v=0):opcode(o), value(v){}
+};
+
+enum ExpressionBinding{
+    BIND_SECTIONS, // defined symbols are offsets in their section, externs count as UND, an undefined symbol stops the evaluation (.equ)
+    BIND_SYMBOLS // every symbol that is not an ABS constant stays a term of its own (operands)
+};
+
+struct ExpressionTerm{
+    string base; // section or symbol name, depending on the binding
+    int coefficient;
+
+    ExpressionTerm(string b, int c):base(b), coefficient(c){}
+};
+
+// constant + sum of coefficient * base, terms with coefficient 0 are dropped
+struct ExpressionValue{
+    int constant;
+    vector<ExpressionTerm> terms;
+
+    ExpressionValue(int c=0):constant(c), terms(){}
+};
+
+/*
+    Integer expression of .equ, .if and operands: literals, symbols, parentheses
+    and the C operators (unary - ~ !, * / %, + -, << >>, comparisons, & ^ |,
+    && ||) with C precedence.
+
+    compile() parses the text once into a postfix program. Constant subtrees are
+    folded while the program is emitted, as are ABS symbols already defined when
+    a symbol table is given, so "x+2*3+1" is two ops and a fully constant
+    expression is a single EXPR_CONSTANT. evaluate() runs the program over the
+    symbol table as often as needed, values carry the coefficient of every
+    section/symbol so relocatability is checked in the same pass: only + and -
+    (and * by a constant) may have a relocatable operand.
+*/
+class Expression{
+    private:
+        size_t at; // parser position in text
+        string text;
+
+        bool parseBinary(int min_precedence, SymbolTable* st);
+        bool parseUnary(SymbolTable* st);
+        bool parsePrimary(SymbolTable* st);
+        int binaryOperator(unsigned char& opcode, size_t& length); // precedence of the operator at 'at', 0 if none
+        void emitUnary(unsigned char opcode, size_t start); // appends op, folded if its operand is a constant
+        void emitBinary(unsigned char opcode, size_t left_start, size_t right_start);
+        void skipBlanks();
+        bool fail(string message);
+    public:
+        vector<ExpressionOp> program;
+        vector<string> symbols; // names of EXPR_SYMBOL operands, in order of first appearance
+        string error;
+
+        bool compile(const string& expression, SymbolTable* st=nullptr); // ABS symbols of st defined by now are folded
+        bool isConstant(){ return program.size() == 1 && program[0].opcode == EXPR_CONSTANT; }
+        bool evaluate(SymbolTable* st, ExpressionBinding binding, ExpressionValue& result, string& missing); // false with missing set, or with error set
+};
+
+#endif
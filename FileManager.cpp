@@ -6,9 +6,13 @@ FileManager::FileManager(){}
 vector<string> FileManager::getContent(string fname){
     content = {};
     string line;
-    file.open(fname, ios::in | ios::out);
+    if(fname == "-"){ // source comes from a pipe
+        readLines(cin);
+        return content;
+    }
+    file.open(fname, ios::in);
     if(file.is_open()==false){
-        cout<<"File "<<fname<< " cannot be opened"<<endl;
+        cerr<<"File "<<fname<< " cannot be opened"<<endl;
         return content;
     }
     while(getline(file, line)){
@@ -18,11 +22,38 @@ vector<string> FileManager::getContent(string fname){
     return content;
 }
 
+void FileManager::readLines(istream& in){
+    // read in big blocks and split here, getline on an unsynchronized stdin is slow
+    vector<char> buffer(STREAM_BUFFER_SIZE);
+    string partial = "";
+    while(in.read(buffer.data(), buffer.size()) || in.gcount() > 0){
+        const char* begin = buffer.data();
+        const char* end = begin + in.gcount();
+        for(const char* p = begin; p < end;){
+            const char* newline = (const char*)memchr(p, '\n', end - p);
+            if(newline == nullptr){
+                partial.append(p, end - p);
+                break;
+            }
+            partial.append(p, newline - p);
+            content.push_back(partial);
+            partial.clear();
+            p = newline + 1;
+        }
+    }
+    if(partial != "") content.push_back(partial);
+}
+
 void FileManager::setContent(string output, string fname){
     this->content = content;
-    file.open(fname, ios::in | ios::out);
+    if(fname == "-"){ // object goes to a pipe, one big write
+        cout.write(output.data(), output.size());
+        cout.flush();
+        return;
+    }
+    file.open(fname, ios::out | ios::trunc);
     if(file.is_open()==false){
-        cout<<"File "<<fname<< " cannot be opened!"<<endl;
+        cerr<<"File "<<fname<< " cannot be opened!"<<endl;
         exit(1);
         return;
     }
@@ -6,16 +6,19 @@
 #include <fstream>
 #include <vector>
 
+#define STREAM_BUFFER_SIZE (1 << 20) // block size for reading stdin
+
 using namespace std;
 
 class FileManager{
     private:
         fstream file;
         vector<string> content;
+        void readLines(istream& in);
     public:
         FileManager();
-        vector<string> getContent(string fname);
-        void setContent(string output, string fname);
+        vector<string> getContent(string fname); // "-" reads stdin
+        void setContent(string output, string fname); // "-" writes stdout, files are created or truncated
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,91 @@
+#include "IncludeCache.h"
+#include <stdlib.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+mutex IncludeCache::lock;
+unordered_map<string, shared_ptr<IncludedFile>> IncludeCache::files;
+
+string IncludeCache::resolve(string file_name, string including_file){
+    char resolved[PATH_MAX];
+    size_t slash = including_file.find_last_of('/');
+    if(file_name[0] != '/' && slash != string::npos){
+        string next_to = including_file.substr(0, slash + 1) + file_name;
+        if(realpath(next_to.c_str(), resolved) != nullptr) return resolved;
+    }
+    if(realpath(file_name.c_str(), resolved) != nullptr) return resolved;
+    return "";
+}
+
+string IncludeCache::findGuard(const vector<IncludedLine>& lines){
+    // .ifndef X on the first line has to be closed by the last one, with no .else of its own
+    if(lines.size() < 2) return "";
+    const vector<string>& first = lines[0].tokens;
+    if(first.size() != 2 || first[0] != ".ifndef" || lines.back().tokens.size() != 1 || lines.back().tokens[0] != ".endif") return "";
+    int depth = 0;
+    for(size_t i = 0; i < lines.size(); i++){
+        const vector<string>& tokens = lines[i].tokens;
+        const string& directive = tokens[0].find(':') != string::npos && tokens.size() > 1 ? tokens[1] : tokens[0];
+        if(directive == ".if" || directive == ".ifdef" || directive == ".ifndef") depth++;
+        else if(directive == ".else" && depth == 1) return "";
+        else if(directive == ".endif" && --depth == 0 && i + 1 < lines.size()) return "";
+    }
+    return first[1];
+}
+
+shared_ptr<IncludedFile> IncludeCache::get(string path, function<vector<string>(const string&)> lex, string& error){
+    struct stat info;
+    if(stat(path.c_str(), &info) != 0){
+        error = "File " + path + " cannot be opened.";
+        return nullptr;
+    }
+    long long modified = info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+    {
+        lock_guard<mutex> guard(lock);
+        unordered_map<string, shared_ptr<IncludedFile>>::iterator it = files.find(path);
+        if(it != files.end()){
+            IncludedFile& file = *it->second;
+            if(file.device == info.st_dev && file.inode == info.st_ino && file.size == info.st_size && file.modified == modified) return it->second;
+        }
+    }
+    // lexed outside the lock, two threads missing the same file both lex it and the last one stays
+    shared_ptr<IncludedFile> file = make_shared<IncludedFile>();
+    file->path = path;
+    file->device = info.st_dev;
+    file->inode = info.st_ino;
+    file->size = info.st_size;
+    file->modified = modified;
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+        error = "File " + path + " cannot be opened.";
+        return nullptr;
+    }
+    if(info.st_size > 0){
+        void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapped == MAP_FAILED){
+            close(fd);
+            error = "File " + path + " cannot be mapped.";
+            return nullptr;
+        }
+        madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+        const char* end = (const char*)mapped + info.st_size;
+        int line_number = 0;
+        for(const char* line = (const char*)mapped; line < end;){
+            const char* line_end = (const char*)memchr(line, '\n', end - line);
+            if(line_end == nullptr) line_end = end;
+            line_number++;
+            vector<string> tokens = lex(string(line, line_end));
+            if(tokens.size() > 0) file->lines.push_back(IncludedLine(line_number, tokens));
+            line = line_end + 1;
+        }
+        munmap(mapped, info.st_size);
+    }
+    close(fd);
+    file->guard = findGuard(file->lines);
+    lock_guard<mutex> guard(lock);
+    files[path] = file;
+    return file;
+}
@@ -0,0 +1,49 @@
+#ifndef INCLUDECACHE_H
+#define INCLUDECACHE_H
+
+#include "INCLUDES.h"
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <unordered_map>
+
+struct IncludedLine{
+    int line; // in the included file, for errors
+    vector<string> tokens; // as lexLine returned them
+
+    IncludedLine(int l, vector<string> t):line(l), tokens(t){}
+};
+
+struct IncludedFile{
+    string path; // canonical
+    unsigned long long device;
+    unsigned long long inode;
+    long long size;
+    long long modified; // nanoseconds, with device, inode and size tells if the file changed since it was lexed
+    vector<IncludedLine> lines; // blank and comment lines are left out
+    string guard; // X when the whole file is .ifndef X ... .endif, empty otherwise
+};
+
+/*
+    Files of .include, shared by every Assembler of the process and by its
+    threads. A file is mapped and lexed once: later includes of it, from the
+    same module or another one, get the tokens of every line without reading
+    or lexing anything. An entry is used as long as stat() reports the same
+    file, a file that was written since is lexed again.
+
+    When the whole file is wrapped in .ifndef X / .endif (include guard), X
+    is remembered, so including it again once X is defined costs a lookup.
+*/
+class IncludeCache{
+    private:
+        static mutex lock;
+        static unordered_map<string, shared_ptr<IncludedFile>> files; // canonical path -> file
+
+        static string findGuard(const vector<IncludedLine>& lines);
+    public:
+        static string resolve(string file_name, string including_file); // canonical path, relative names are tried next to the including file first, empty if not found
+        static shared_ptr<IncludedFile> get(string path, function<vector<string>(const string&)> lex, string& error); // null and error set if the file can't be read
+};
+
+#endif
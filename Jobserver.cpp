@@ -0,0 +1,79 @@
+#include "Jobserver.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+Jobserver* Jobserver::active = nullptr;
+
+Jobserver::~Jobserver(){
+    close(read_fd);
+}
+
+bool Jobserver::tryAcquire(char& token){
+    ssize_t n;
+    do n = read(read_fd, &token, 1); while(n < 0 && errno == EINTR);
+    return n == 1;
+}
+
+void Jobserver::release(char token){
+    ssize_t n;
+    do n = write(write_fd, &token, 1); while(n < 0 && errno == EINTR);
+}
+
+int Jobserver::descriptor(){
+    return read_fd;
+}
+
+static bool isFifo(int fd){
+    struct stat info;
+    return fcntl(fd, F_GETFD) != -1 && fstat(fd, &info) == 0 && S_ISFIFO(info.st_mode);
+}
+
+Jobserver* Jobserver::fromEnvironment(){
+    const char* flags = getenv("MAKEFLAGS");
+    if(flags == nullptr) return nullptr;
+    string makeflags = flags;
+    // the last option wins, make before 4.2 calls it --jobserver-fds
+    size_t at = makeflags.rfind("--jobserver-auth=");
+    size_t skip = 17;
+    if(at == string::npos){
+        at = makeflags.rfind("--jobserver-fds=");
+        skip = 16;
+    }
+    if(at == string::npos) return nullptr;
+    string auth = makeflags.substr(at + skip, makeflags.find(' ', at) - at - skip);
+    if(auth.find("fifo:") == 0){
+        string path = auth.substr(5);
+        int r = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        int w = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+        if(r < 0 || w < 0){
+            if(r >= 0) close(r);
+            if(w >= 0) close(w);
+            return nullptr;
+        }
+        return new Jobserver(r, w);
+    }
+    size_t comma = auth.find(',');
+    if(comma == string::npos) return nullptr;
+    int r = atoi(auth.substr(0, comma).c_str()), w = atoi(auth.substr(comma + 1).c_str());
+    // make closes the pipe for jobs not marked recursive, the numbers may then belong to anything
+    if(!isFifo(r) || !isFifo(w)) return nullptr;
+    // the pipe is shared with make and its other jobs, so O_NONBLOCK goes on a private open of it
+    int own = open(("/proc/self/fd/" + to_string(r)).c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if(own < 0) return nullptr;
+    return new Jobserver(own, w);
+}
+
+Jobserver* Jobserver::create(int slots){
+    int fds[2];
+    if(pipe(fds) != 0) return nullptr;
+    for(int i = 1; i < slots; i++){
+        char token = '+';
+        if(write(fds[1], &token, 1) != 1) break;
+    }
+    string makeflags = getenv("MAKEFLAGS") == nullptr ? "" : string(getenv("MAKEFLAGS")) + " ";
+    setenv("MAKEFLAGS", (makeflags + "--jobserver-auth=" + to_string(fds[0]) + "," + to_string(fds[1])).c_str(), 1);
+    return fromEnvironment();
+}
@@ -0,0 +1,37 @@
+#ifndef JOBSERVER_H
+#define JOBSERVER_H
+
+#include "INCLUDES.h"
+
+/*
+    Client of the GNU make jobserver. make -j hands every job one implicit
+    slot, anything that wants to run more in parallel first reads a token from
+    the jobserver (a pipe given as --jobserver-auth=R,W, or a named fifo given as
+    --jobserver-auth=fifo:PATH in MAKEFLAGS) and writes the same byte back when
+    it is done. Worker threads of Assembler::end() and the processes of --batch
+    take tokens this way, so the assembler and make share one CPU budget.
+
+    Tokens are only taken when one is free right now. Waiting for one while
+    holding others could deadlock with the other jobs, and the calling thread
+    can always do the work itself.
+*/
+class Jobserver{
+    private:
+        int read_fd; // own non blocking open of the read end
+        int write_fd;
+
+        Jobserver(int r, int w):read_fd(r), write_fd(w){}
+    public:
+        static Jobserver* active; // null when not run under make -j
+
+        ~Jobserver();
+
+        bool tryAcquire(char& token); // takes a token if one is free right now
+        void release(char token); // gives back a token from tryAcquire
+        int descriptor(); // readable when a token may be free, for poll
+
+        static Jobserver* fromEnvironment(); // null if MAKEFLAGS has no usable jobserver
+        static Jobserver* create(int slots); // own jobserver with slots-1 tokens, exported through MAKEFLAGS to child processes
+};
+
+#endif
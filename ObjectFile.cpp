@@ -0,0 +1,299 @@
+#include "ObjectFile.h"
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+ObjectFile::ObjectFile(){
+    st = new SymbolTable();
+    sections = {};
+    mapped = nullptr;
+    mapped_size = 0;
+}
+
+ObjectFile::~ObjectFile(){
+    for(Section* section: sections){
+        delete section;
+    }
+    sections.clear();
+    delete st;
+    if(mapped != nullptr) munmap((void*)mapped, mapped_size);
+}
+
+static bool isBlank(char c){
+    return c == ' ' || c == '\r';
+}
+
+// [begin, end) without surrounding blanks
+static string trim(const char* begin, const char* end){
+    while(begin < end && isBlank(*begin)) begin++;
+    while(end > begin && isBlank(end[-1])) end--;
+    return string(begin, end);
+}
+
+// splits on '|' into at most max columns, returns the number of columns found (max+1 if there are more)
+static int splitColumns(const char* begin, const char* end, string* columns, int max){
+    int count = 0;
+    while(count < max){
+        const char* bar = (const char*)memchr(begin, '|', end - begin);
+        if(bar == nullptr) bar = end;
+        columns[count++] = trim(begin, bar);
+        if(bar == end) return count;
+        begin = bar + 1;
+    }
+    return count + 1;
+}
+
+static bool parseInt(const string& x, int& value){
+    if(x.empty()) return false;
+    char* end;
+    value = strtol(x.c_str(), &end, 10);
+    return *end == '\0';
+}
+
+static int hexDigit(char c){
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static bool startsWith(const char* begin, const char* end, const char* prefix){
+    size_t n = strlen(prefix);
+    return (size_t)(end - begin) >= n && memcmp(begin, prefix, n) == 0;
+}
+
+bool ObjectFile::fail(string message, int line){
+    error = message + " On line:" + to_string(line);
+    return false;
+}
+
+bool ObjectFile::read(string file_name){
+    int fd = open(file_name.c_str(), O_RDONLY);
+    struct stat file_stat;
+    if(fd < 0 || fstat(fd, &file_stat) != 0){
+        if(fd >= 0) close(fd);
+        error = "File " + file_name + " cannot be opened";
+        return false;
+    }
+    mapped_size = file_stat.st_size;
+    if(mapped_size > 0){
+        void* data = mmap(nullptr, mapped_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data == MAP_FAILED){
+            close(fd);
+            error = "File " + file_name + " cannot be mapped";
+            return false;
+        }
+        madvise(data, mapped_size, MADV_SEQUENTIAL);
+        mapped = (const char*)data;
+    }
+    close(fd);
+    return parse(mapped, mapped_size);
+}
+
+bool ObjectFile::readBuffer(const char* data, size_t size){
+    return parse(data, size);
+}
+
+bool ObjectFile::parse(const char* data, size_t size){
+    /*
+        Layout: "#.ret<section>" with a relocation table for every section, then
+        "#SYMBOL TABLE: " and "MACHINE CODE:" followed by "#<section>" and a
+        line of hex bytes for every section. Sections declared with attributes
+        follow in "SECTION FLAGS:" as "#<section>" and "rw- nobits <size>", a
+        nobits section has an empty hex line. Objects assembled with -g end with
+        "LINE TABLE:" and the same two lines for every section that has rows.
+    */
+    enum { NONE, RELOCATIONS, SYMBOLS, CODE, FLAGS, LINES } part = NONE;
+    Section* current = nullptr;
+    int line_number = 0;
+    bool header = false; // next line is a table header
+    string columns[5];
+    const char* end = data + size;
+    for(const char* line = data; line < end;){
+        const char* line_end = (const char*)memchr(line, '\n', end - line);
+        if(line_end == nullptr) line_end = end;
+        const char* next = line_end < end ? line_end + 1 : end;
+        line_number++;
+        if(startsWith(line, line_end, "#.ret")){
+            current = new Section(trim(line + 5, line_end));
+            section_index.emplace(current->name, sections.size());
+            sections.push_back(current);
+            code.push_back(LazyCode());
+            part = RELOCATIONS;
+            header = true;
+        }
+        else if(startsWith(line, line_end, "#SYMBOL TABLE:")){
+            part = SYMBOLS;
+            header = true;
+        }
+        else if(startsWith(line, line_end, "MACHINE CODE:")){
+            part = CODE;
+        }
+        else if(startsWith(line, line_end, "SECTION FLAGS:")){
+            part = FLAGS;
+        }
+        else if(startsWith(line, line_end, "LINE TABLE:")){
+            part = LINES;
+        }
+        else if(header){
+            header = false;
+        }
+        else switch(part){
+        case RELOCATIONS:
+        {
+            if(trim(line, line_end) == "") break;
+            int offset, value;
+            if(splitColumns(line, line_end, columns, 3) != 3 || !parseInt(columns[0], offset) || !parseInt(columns[2], value)) return fail("Malformed relocation record.", line_number);
+            current->relocation_table.push_back(RelocationTableEntry(offset, value, columns[1], ""));
+            break;
+        }
+        case SYMBOLS:
+        {
+            if(trim(line, line_end) == "") break;
+            int offset, id;
+            if(splitColumns(line, line_end, columns, 5) != 5 || !parseInt(columns[2], offset) || !parseInt(columns[4], id)) return fail("Malformed symbol table entry.", line_number);
+            bool local = columns[3] == "l";
+            SymbolTableEntry ste(columns[0], columns[1], (short int)offset, local, columns[1] != "UND", columns[1] == "UND" && !local);
+            ste.id = id;
+            id_index.emplace(ste.id, st->table.size());
+            st->addSymbol(ste);
+            break;
+        }
+        case CODE:
+        {
+            if(line == line_end || line[0] != '#') return fail("Expected section name.", line_number);
+            unordered_map<string, size_t>::iterator it = section_index.find(string(line + 1, line_end));
+            if(it == section_index.end()) return fail("Machine code of unknown section " + string(line + 1, line_end) + ".", line_number);
+            // only located here, decodeSection() turns it into bytes
+            const char* hex = next;
+            const char* hex_end = hex < end ? (const char*)memchr(hex, '\n', end - hex) : nullptr;
+            if(hex_end == nullptr) hex_end = end;
+            next = hex_end < end ? hex_end + 1 : end;
+            line_number++;
+            while(hex < hex_end && isBlank(*hex)) hex++;
+            while(hex_end > hex && isBlank(hex_end[-1])) hex_end--;
+            if((hex_end - hex) % 2 != 0) return fail("Odd number of hex digits.", line_number);
+            LazyCode& lazy = code[it->second];
+            lazy.hex = hex;
+            lazy.length = hex_end - hex;
+            lazy.decoded = false;
+            sections[it->second]->location_counter = lazy.length / 2;
+            break;
+        }
+        case FLAGS:
+        {
+            if(line == line_end || line[0] != '#') return fail("Expected section name.", line_number);
+            unordered_map<string, size_t>::iterator it = section_index.find(string(line + 1, line_end));
+            if(it == section_index.end()) return fail("Flags of unknown section " + string(line + 1, line_end) + ".", line_number);
+            const char* flags = next;
+            const char* flags_end = flags < end ? (const char*)memchr(flags, '\n', end - flags) : nullptr;
+            if(flags_end == nullptr) flags_end = end;
+            next = flags_end < end ? flags_end + 1 : end;
+            line_number++;
+            Section* section = sections[it->second];
+            if(!section->parseFlags(string(flags, flags_end))) return fail("Malformed section flags.", line_number);
+            if(section->nobits() && code[it->second].length > 0) return fail("Machine code in nobits section " + section->name + ".", line_number);
+            break;
+        }
+        case LINES:
+        {
+            if(line == line_end || line[0] != '#') return fail("Expected section name.", line_number);
+            unordered_map<string, size_t>::iterator it = section_index.find(string(line + 1, line_end));
+            if(it == section_index.end()) return fail("Line table of unknown section " + string(line + 1, line_end) + ".", line_number);
+            // a few bytes per source line, decoded right away
+            const char* hex = next;
+            const char* hex_end = hex < end ? (const char*)memchr(hex, '\n', end - hex) : nullptr;
+            if(hex_end == nullptr) hex_end = end;
+            next = hex_end < end ? hex_end + 1 : end;
+            line_number++;
+            while(hex < hex_end && isBlank(*hex)) hex++;
+            while(hex_end > hex && isBlank(hex_end[-1])) hex_end--;
+            if((hex_end - hex) % 2 != 0) return fail("Odd number of hex digits.", line_number);
+            vector<char>& table = sections[it->second]->line_table;
+            for(const char* p = hex; p < hex_end; p += 2){
+                int high = hexDigit(p[0]), low = hexDigit(p[1]);
+                if(high < 0 || low < 0) return fail("Malformed line table.", line_number);
+                table.push_back((char)(high << 4 | low));
+            }
+            break;
+        }
+        case NONE:
+            if(trim(line, line_end) != "") return fail("Unexpected line.", line_number);
+            break;
+        }
+        line = next;
+    }
+    // relocation records only carry ids, fill in names for readers
+    for(Section* section: sections){
+        for(RelocationTableEntry& rte: section->relocation_table){
+            SymbolTableEntry* ste = findSymbolById(rte.value);
+            if(ste == nullptr) return fail("Relocation in section " + section->name + " refers to unknown symbol id " + to_string(rte.value) + ".", line_number);
+            rte.symbol_name = ste->name;
+        }
+    }
+    return true;
+}
+
+bool ObjectFile::decodeSection(Section* section){
+    LazyCode& lazy = code[section_index.find(section->name)->second];
+    if(lazy.decoded) return true;
+    vector<char>& machine_code = section->machine_code;
+    machine_code.resize(lazy.length / 2);
+    for(size_t i = 0; i < lazy.length; i += 2){
+        int high = hexDigit(lazy.hex[i]), low = hexDigit(lazy.hex[i+1]);
+        if(high < 0 || low < 0){
+            machine_code.clear();
+            return false;
+        }
+        machine_code[i / 2] = (char)(high << 4 | low);
+    }
+    lazy.decoded = true;
+    return true;
+}
+
+bool ObjectFile::decodeAll(){
+    for(Section* section: sections){
+        if(!decodeSection(section)){
+            error = "Invalid hex digit in machine code of section " + section->name + ".";
+            return false;
+        }
+    }
+    return true;
+}
+
+SymbolTableEntry* ObjectFile::findSymbol(string name){
+    return st->findSymbol(name);
+}
+
+SymbolTableEntry* ObjectFile::findSymbolById(int id){
+    unordered_map<int, size_t>::iterator it = id_index.find(id);
+    if(it == id_index.end()) return nullptr;
+    return &st->table[it->second];
+}
+
+Section* ObjectFile::findSection(string name){
+    unordered_map<string, size_t>::iterator it = section_index.find(name);
+    if(it == section_index.end()) return nullptr;
+    return sections[it->second];
+}
+
+string ObjectFile::toString(){
+    stringstream output;
+    for(Section* section: sections){
+        output<<"#.ret"<<section->name<<endl;
+        output<<section->getRelocationTable()<<endl;
+    }
+    output<<st->toString();
+    output<<"MACHINE CODE:"<<endl;
+    for(size_t i = 0; i < sections.size(); i++){
+        output<<"#"<<sections[i]->name<<endl;
+        // sections nobody decoded are copied as they were read
+        if(code[i].decoded) output<<sections[i]->getMachineCodeString()<<endl;
+        else output.write(code[i].hex, code[i].length)<<endl;
+    }
+    output<<Section::getSectionFlags(sections);
+    output<<Section::getLineTables(sections);
+    return output.str();
+}
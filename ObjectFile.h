@@ -0,0 +1,57 @@
+#ifndef OBJECTFILE_H
+#define OBJECTFILE_H
+
+#include "INCLUDES.h"
+#include "Section.h"
+#include "SymbolTable.h"
+#include <vector>
+#include <unordered_map>
+
+struct LazyCode{
+    const char* hex; // hex line of the section inside the object text
+    size_t length;
+    bool decoded;
+
+    LazyCode():hex(nullptr), length(0), decoded(true){}
+};
+
+/*
+    Reader of the text object files written by Assembler::end(), shared by the
+    tools that consume assembler output. Sections keep their relocation tables,
+    symbols keep the ids that relocation values refer to.
+
+    The file is mapped and indexed in one pass over its lines. Machine code is
+    only located during that pass: location_counter holds the size of every
+    section, and the hex line is decoded into machine_code by decodeSection(),
+    so tools that only need symbols never touch it. toString() writes the object
+    back byte for byte.
+*/
+class ObjectFile{
+    private:
+        unordered_map<int, size_t> id_index; // symbol id -> position in st->table
+        unordered_map<string, size_t> section_index; // name -> position in sections
+        vector<LazyCode> code; // parallel to sections
+        const char* mapped; // owned mapping of read(), null for readBuffer()
+        size_t mapped_size;
+
+        bool fail(string message, int line); // sets error, always false
+        bool parse(const char* data, size_t size);
+    public:
+        vector<Section*> sections; // in file order
+        SymbolTable* st;
+        string error; // reason the last read failed
+
+        ObjectFile();
+        ~ObjectFile();
+
+        bool read(string file_name); // false if the file can't be opened or parsed
+        bool readBuffer(const char* data, size_t size); // object text already in memory, e.g. an archive member, has to outlive the ObjectFile
+        bool decodeSection(Section* section); // fills machine_code on first use, false on a malformed hex line, safe to call concurrently for different sections
+        bool decodeAll(); // sets error for the first malformed section
+        SymbolTableEntry* findSymbol(string name);
+        SymbolTableEntry* findSymbolById(int id);
+        Section* findSection(string name);
+        string toString(); // same text as Assembler::end() wrote
+};
+
+#endif
@@ -5,6 +5,20 @@ Section::Section(string n):name(n){
     relocation_table = {};
     machine_code = {};
     location_counter = 0;
+    flags = SECTION_DEFAULT_FLAGS;
+    line_table = {};
+    last_line_address = 0;
+    last_line = 0;
+}
+
+void Section::clear(){
+    machine_code.clear();
+    relocation_table.clear();
+    location_counter = 0;
+    flags = SECTION_DEFAULT_FLAGS;
+    line_table.clear();
+    last_line_address = 0;
+    last_line = 0;
 }
 
 string Section::getMachineCodeString(){
@@ -24,6 +38,114 @@ vector<char>& Section::getMachineCode(){
     return machine_code;
 }
 
+bool Section::setFlags(const string& letters, const string& type){
+    int parsed = 0;
+    for(char c: letters){
+        if(c == 'w') parsed |= SECTION_WRITE;
+        else if(c == 'x') parsed |= SECTION_EXEC;
+        else if(c != 'a') return false; // every section is allocated
+    }
+    if(type == "@nobits" || type == "%nobits") parsed |= SECTION_NOBITS;
+    else if(type != "" && type != "@progbits" && type != "%progbits") return false;
+    flags = parsed;
+    return true;
+}
+
+string Section::getFlagsString(){
+    string out = "r";
+    out += flags & SECTION_WRITE ? 'w' : '-';
+    out += flags & SECTION_EXEC ? 'x' : '-';
+    out += nobits() ? " nobits " : " progbits ";
+    return out + to_string(location_counter);
+}
+
+bool Section::parseFlags(const string& text){
+    stringstream ss(text);
+    string access, type;
+    int size;
+    if(!(ss >> access >> type >> size) || access.size() != 3 || access[0] != 'r' || size < 0) return false;
+    if((access[1] != 'w' && access[1] != '-') || (access[2] != 'x' && access[2] != '-')) return false;
+    if(type != "nobits" && type != "progbits") return false;
+    flags = (access[1] == 'w' ? SECTION_WRITE : 0) | (access[2] == 'x' ? SECTION_EXEC : 0) | (type == "nobits" ? SECTION_NOBITS : 0);
+    if(nobits()) location_counter = size;
+    return nobits() || size == location_counter;
+}
+
+string Section::getSectionFlags(const vector<Section*>& sections){
+    string out = "";
+    for(Section* section: sections){
+        if(section->flags == SECTION_DEFAULT_FLAGS) continue;
+        if(out == "") out = "SECTION FLAGS:\n";
+        out += "#" + section->name + "\n" + section->getFlagsString() + "\n";
+    }
+    return out;
+}
+
+void Section::appendVarint(unsigned int value){
+    // 7 bits per byte, low bits first, high bit set on all but the last byte
+    while(value >= 0x80){
+        line_table.push_back((char)((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    line_table.push_back((char)value);
+}
+
+void Section::addLine(int address, int line){
+    if(line == last_line && !line_table.empty()) return; // still the same row
+    int line_delta = line - last_line;
+    appendVarint(address - last_line_address);
+    appendVarint(((unsigned int)line_delta << 1) ^ (unsigned int)(line_delta >> 31)); // zigzag, small negative deltas stay short
+    last_line_address = address;
+    last_line = line;
+}
+
+string Section::getLineTableString(){
+    return byteCodeToString(line_table);
+}
+
+string Section::getLineTables(const vector<Section*>& sections){
+    string out = "";
+    for(Section* section: sections){
+        if(section->line_table.empty()) continue;
+        if(out == "") out = "LINE TABLE:\n";
+        out += "#" + section->name + "\n" + section->getLineTableString() + "\n";
+    }
+    return out;
+}
+
+bool Section::decodeLines(vector<LineRow>& rows){
+    rows.clear();
+    LineRow row = {0, 0};
+    size_t at = 0;
+    while(at < line_table.size()){
+        unsigned int values[2];
+        for(int i = 0; i < 2; i++){
+            values[i] = 0;
+            for(int shift = 0;; shift += 7){
+                if(at == line_table.size() || shift > 28) return false;
+                unsigned char byte = line_table[at++];
+                values[i] |= (unsigned int)(byte & 0x7F) << shift;
+                if((byte & 0x80) == 0) break;
+            }
+        }
+        row.address += values[0];
+        row.line += (int)(values[1] >> 1) ^ -(int)(values[1] & 1);
+        rows.push_back(row);
+    }
+    return true;
+}
+
+int Section::lineAt(const vector<LineRow>& rows, int address){
+    // last row starting at or before address
+    size_t low = 0, high = rows.size();
+    while(low < high){
+        size_t middle = (low + high) / 2;
+        if(rows[middle].address <= address) low = middle + 1;
+        else high = middle;
+    }
+    return low == 0 ? 0 : rows[low - 1].line;
+}
+
 /*! Center-aligns string within a field of width w. Pads with blank spaces
     to enforce alignment. */
 string center1(const string s, const int w) {
@@ -3,6 +3,11 @@
 #include "INCLUDES.h"
 #include <vector>
 
+#define SECTION_WRITE 0x1
+#define SECTION_EXEC 0x2
+#define SECTION_NOBITS 0x4 // only a size, no contents in the object
+#define SECTION_DEFAULT_FLAGS (SECTION_WRITE | SECTION_EXEC) // sections without attributes, as before they existed
+
 struct RelocationTableEntry{
     int offset;
     string type;
@@ -12,16 +17,30 @@ struct RelocationTableEntry{
     RelocationTableEntry(int o, int v, string t, string syn):offset(o), type(t), value(v), symbol_name(syn){}
 };
 
+struct LineRow{
+    int address; // code from here up to the next row's address
+    int line; // comes from this source line
+};
+
 class Section{
+    private:
+        int last_line_address; // of the last row added, the next one is a delta to it
+        int last_line;
+
+        void appendVarint(unsigned int value);
     public:
         string name;
         vector<char> machine_code;
         vector<RelocationTableEntry> relocation_table;
         int location_counter;
+        int flags; // SECTION_*
+        vector<char> line_table; // with -g: rows of (address delta, line delta) as LEB128 varints, the line delta zigzag encoded
 
         Section(string n);
         ~Section();
 
+        void clear(); // empty again, like a new section with the same name, buffers keep their capacity
+
         string getMachineCodeString();
         string getRelocationTable();
         
@@ -29,6 +48,18 @@ class Section{
 
         vector<char>& getMachineCode();
 
+        bool nobits(){ return flags & SECTION_NOBITS; }
+        bool setFlags(const string& letters, const string& type); // .section attributes: letters of "awx", type @progbits/@nobits, false if either is unknown
+        string getFlagsString(); // "rw- nobits <size>"
+        bool parseFlags(const string& text); // line of getFlagsString(), false if malformed
+        static string getSectionFlags(const vector<Section*>& sections); // SECTION FLAGS part of an object, empty if every section has the default flags
+
+        void addLine(int address, int line); // code from address on comes from line, rows are added in address order
+        string getLineTableString();
+        static string getLineTables(const vector<Section*>& sections); // LINE TABLE part of an object, empty if no section has rows
+        bool decodeLines(vector<LineRow>& rows); // false on a truncated table
+        static int lineAt(const vector<LineRow>& rows, int address); // binary search, 0 before the first row
+
 };
 
 #endif
\ No newline at end of file
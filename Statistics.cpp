@@ -0,0 +1,148 @@
+#include "Statistics.h"
+#include "AllocationProfile.h"
+#include <sstream>
+#include <iomanip>
+#include <time.h>
+#include <sys/resource.h>
+
+Statistics::Statistics(){
+    for(int i = 0; i < PHASE_COUNT; i++){
+        wall[i] = 0;
+        cpu[i] = 0;
+        rss_kb[i] = 0;
+    }
+    lines = 0;
+    symbols = 0;
+    forward_references = 0;
+    relocations = 0;
+    peak_rss_kb = 0;
+    instructions = {};
+    sections = {};
+}
+
+const char* Statistics::phaseName(Phase phase){
+    switch(phase){
+        case PHASE_READ: return "read";
+        case PHASE_PROCESS: return "process";
+        case PHASE_RESOLVE: return "resolve_equ";
+        case PHASE_BACKPATCH: return "backpatch";
+        case PHASE_RELOCATIONS: return "relocations";
+        case PHASE_FORMAT: return "format";
+        case PHASE_WRITE: return "write";
+        default: return "unknown";
+    }
+}
+
+double Statistics::threadCpuTime(){
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+long Statistics::peakRss(){
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+void Statistics::addTime(Phase phase, double wall_seconds, double cpu_seconds){
+    long rss = peakRss();
+    lock_guard<mutex> guard(lock);
+    wall[phase] += wall_seconds;
+    cpu[phase] += cpu_seconds;
+    if(rss > rss_kb[phase]) rss_kb[phase] = rss;
+}
+
+void Statistics::countInstruction(string mnemonic){
+    instructions[mnemonic] += 1;
+}
+
+void Statistics::finish(){
+    peak_rss_kb = peakRss();
+}
+
+string Statistics::toString(){
+    stringstream ss;
+    ss<<fixed<<setprecision(3);
+    ss<<"phase          wall ms     cpu ms  peak rss KB"<<endl;
+    double total_wall = 0, total_cpu = 0;
+    for(int i = 0; i < PHASE_COUNT; i++){
+        ss<<left<<setw(12)<<phaseName((Phase)i)<<right<<setw(10)<<wall[i]*1000<<setw(11)<<cpu[i]*1000<<setw(13)<<rss_kb[i]<<endl;
+        total_wall += wall[i];
+        total_cpu += cpu[i];
+    }
+    ss<<left<<setw(12)<<"total"<<right<<setw(10)<<total_wall*1000<<setw(11)<<total_cpu*1000<<endl;
+    ss<<"lines:              "<<lines<<endl;
+    ss<<"symbols:            "<<symbols<<endl;
+    ss<<"forward references: "<<forward_references<<endl;
+    ss<<"relocations:        "<<relocations<<endl;
+    ss<<"peak rss:           "<<peak_rss_kb<<" KB"<<endl;
+    ss<<"instructions:"<<endl;
+    for(auto& it: instructions) ss<<"  "<<left<<setw(8)<<it.first<<right<<it.second<<endl;
+    ss<<"sections:"<<endl;
+    for(SectionStatistics& s: sections) ss<<"  "<<left<<setw(16)<<s.name<<right<<s.bytes<<" bytes, "<<s.relocations<<" relocations"<<endl;
+    return ss.str();
+}
+
+string Statistics::jsonString(string s){
+    string ret = "\"";
+    for(char c: s){
+        if((unsigned char)c < 0x20){
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            ret += escaped;
+            continue;
+        }
+        if(c == '"' || c == '\\') ret += '\\';
+        ret += c;
+    }
+    return ret + "\"";
+}
+
+string Statistics::toJSON(){
+    stringstream ss;
+    ss<<setprecision(9);
+    ss<<"{\"phases\":{";
+    for(int i = 0; i < PHASE_COUNT; i++){
+        if(i > 0) ss<<",";
+        ss<<jsonString(phaseName((Phase)i))<<":{\"wall\":"<<wall[i]<<",\"cpu\":"<<cpu[i]<<",\"peak_rss_kb\":"<<rss_kb[i]<<"}";
+    }
+    ss<<"},\"lines\":"<<lines
+      <<",\"symbols\":"<<symbols
+      <<",\"forward_references\":"<<forward_references
+      <<",\"relocations\":"<<relocations
+      <<",\"peak_rss_kb\":"<<peak_rss_kb;
+    ss<<",\"instructions\":{";
+    bool first = true;
+    for(auto& it: instructions){
+        if(!first) ss<<",";
+        first = false;
+        ss<<jsonString(it.first)<<":"<<it.second;
+    }
+    ss<<"},\"sections\":[";
+    for(size_t i = 0; i < sections.size(); i++){
+        if(i > 0) ss<<",";
+        ss<<"{\"name\":"<<jsonString(sections[i].name)<<",\"bytes\":"<<sections[i].bytes<<",\"relocations\":"<<sections[i].relocations<<"}";
+    }
+    ss<<"]}"<<endl;
+    return ss.str();
+}
+
+PhaseTimer::PhaseTimer(Statistics* s, Phase p):stats(s), phase(p){
+#ifdef ALLOC_PROFILE
+    previous_phase = AllocationProfile::phase;
+    AllocationProfile::phase = p;
+#endif
+    if(stats == nullptr) return;
+    wall_start = chrono::steady_clock::now();
+    cpu_start = Statistics::threadCpuTime();
+}
+
+PhaseTimer::~PhaseTimer(){
+#ifdef ALLOC_PROFILE
+    AllocationProfile::phase = previous_phase;
+#endif
+    if(stats == nullptr) return;
+    double wall_seconds = chrono::duration<double>(chrono::steady_clock::now() - wall_start).count();
+    stats->addTime(phase, wall_seconds, Statistics::threadCpuTime() - cpu_start);
+}
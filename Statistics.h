@@ -0,0 +1,79 @@
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include "INCLUDES.h"
+#include <vector>
+#include <map>
+#include <mutex>
+#include <chrono>
+
+enum Phase{
+    PHASE_READ,
+    PHASE_PROCESS,
+    PHASE_RESOLVE,
+    PHASE_BACKPATCH,
+    PHASE_RELOCATIONS,
+    PHASE_FORMAT,
+    PHASE_WRITE,
+    PHASE_COUNT
+};
+
+struct SectionStatistics{
+    string name;
+    long long bytes;
+    long long relocations;
+
+    SectionStatistics(string n, long long b, long long r):name(n), bytes(b), relocations(r){}
+};
+
+/*
+    Per phase timings and counters of one assembler run, filled only when --stats is given.
+    Backpatch, relocation and format phases run on several threads, their times are summed
+    over all sections.
+*/
+class Statistics{
+    private:
+        mutex lock;
+    public:
+        double wall[PHASE_COUNT]; // seconds
+        double cpu[PHASE_COUNT];
+        long rss_kb[PHASE_COUNT]; // peak RSS when the phase last finished
+        long long lines;
+        long long symbols;
+        long long forward_references;
+        long long relocations;
+        long peak_rss_kb;
+        map<string, long long> instructions; // per mnemonic
+        vector<SectionStatistics> sections;
+
+        Statistics();
+
+        void addTime(Phase phase, double wall_seconds, double cpu_seconds); // thread safe
+        void countInstruction(string mnemonic);
+        void finish(); // samples peak RSS
+
+        string toString();
+        string toJSON();
+
+        static const char* phaseName(Phase phase);
+        static double threadCpuTime();
+        static long peakRss(); // KB
+        static string jsonString(string s); // quoted, with quotes, backslashes and control characters escaped
+};
+
+// measures wall and thread CPU time of a scope, does nothing if stats is null (except naming the phase for -DALLOC_PROFILE)
+class PhaseTimer{
+    private:
+        Statistics* stats;
+        Phase phase;
+        chrono::steady_clock::time_point wall_start;
+        double cpu_start;
+#ifdef ALLOC_PROFILE
+        int previous_phase;
+#endif
+    public:
+        PhaseTimer(Statistics* s, Phase p);
+        ~PhaseTimer();
+};
+
+#endif
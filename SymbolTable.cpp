@@ -2,15 +2,22 @@
 #include <algorithm>
 #include <sstream>
 
-int SymbolTableEntry::global_id = 0;
+atomic<int> SymbolTableEntry::global_id(0);
 
 SymbolTableEntry* SymbolTable::findSymbol(string symbol){
-    vector<SymbolTableEntry>::iterator it = std::find_if(table.begin(), table.end(), find_symbol(symbol));
-    if(it != table.end()) return it.base();
+    unordered_map<string, size_t>::iterator it = index.find(symbol);
+    if(it != index.end()) return &table[it->second];
     return nullptr;
 }
 
+void SymbolTable::clear(){
+    table.clear();
+    index.clear();
+    pending.clear();
+}
+
 void SymbolTable::addSymbol(SymbolTableEntry symbol){
+    index.emplace(symbol.name, table.size()); // first entry with a name wins, like the linear search did
     table.push_back(symbol);
 }
 
@@ -18,30 +25,41 @@ void SymbolTableEntry::addForwardReference(ForwardReferenceTableEntry frte){
     forward_reference_table.push_back(frte);
 }
 
-void SymbolTableEntry::resolveSymbol(vector<char>* machine_code, string section_name){
-    SymbolTableEntry *ste = this;
-    short int symbol = ste->offset;
-    //cout<<"SYMBOL: "<<this->name<<" FRTE: "<<this->forward_reference_table.size()<<endl;
-    for(ForwardReferenceTableEntry frte: forward_reference_table){
-        if(frte.section != (section_name[0] == '.' ? section_name.substr(1) : section_name)) continue;
-        //cout<<" PATCH: "<<frte.byte;
-        //cout<<"SEC1: "<<frte.section<<" SEC2: "<<ste->section<<endl;
-        int pcrel = frte.pcrel ? ((frte.section == ste->section ? (-frte.byte):0) + frte.end_of_instruction_offset) : 0;
-        (*machine_code)[frte.byte] =  (symbol+pcrel) & 0xFF;
-        (*machine_code)[frte.byte + 1] = ((symbol+pcrel)>>8) & 0xFF; // little endian
-        //cout<< " VALUE: "<< symbol<<endl;
-    }
+void SymbolTableEntry::resolveReference(vector<char>* machine_code, const ForwardReferenceTableEntry& frte){
+    short int symbol = offset;
+    //cout<<"SEC1: "<<frte.section<<" SEC2: "<<section<<endl;
+    // end_of_instruction_offset also carries the addend of label+4, 0 for plain symbols
+    int pcrel = (frte.pcrel && frte.section == section ? (-frte.byte):0) + frte.end_of_instruction_offset;
+    (*machine_code)[frte.byte] =  (symbol+pcrel) & 0xFF;
+    if(frte.size == 2) (*machine_code)[frte.byte + 1] = ((symbol+pcrel)>>8) & 0xFF; // little endian
 }
 
-void SymbolTable::backpatch(vector<char>& machine_code, string section_name){
-    //cout<<"SECTION: "<<section_name;
-    for(SymbolTableEntry ste: table){
+void SymbolTable::checkDefined(){
+    for(SymbolTableEntry& ste: table){
         if(ste.defined == false && ste.section != "UND") {
-            cout<<"Could not resolve symbol: "<<ste.name<<endl;
+            cerr<<"Could not resolve symbol: "<<ste.name<<endl;
             exit(1);
         }
+    }
+}
+
+void SymbolTable::indexForwardReferences(){
+    pending.clear();
+    for(SymbolTableEntry& ste: table){
         if(ste.local==false) continue; // no need to backpatch for global symbols
-        ste.resolveSymbol(&machine_code, section_name);
+        for(ForwardReferenceTableEntry& frte: ste.forward_reference_table){
+            pending[frte.section].push_back(PendingReference(&ste, &frte));
+        }
+    }
+}
+
+void SymbolTable::backpatch(vector<char>& machine_code, string section_name){
+    //cout<<"SECTION: "<<section_name;
+    // only reads the table, so different sections can be backpatched concurrently
+    unordered_map<string, vector<PendingReference>>::iterator it = pending.find(section_name[0] == '.' ? section_name.substr(1) : section_name);
+    if(it == pending.end()) return;
+    for(PendingReference& pr: it->second){
+        pr.symbol->resolveReference(&machine_code, *pr.reference);
     }
 }
 
@@ -87,3 +105,41 @@ string SymbolTable::toString(){
     }
     return ss.str();
 }
+
+string SymbolTable::toSnapshot(size_t first){
+    size_t count = table.size() - first;
+    size_t header = 12;
+    string names = "";
+    vector<SnapshotEntry> entries(count);
+    for(size_t i = 0; i < count; i++){
+        SymbolTableEntry& ste = table[first + i];
+        entries[i].name_offset = header + count * sizeof(SnapshotEntry) + names.size();
+        entries[i].name_length = ste.name.size();
+        entries[i].offset = ste.offset;
+        entries[i].abs = ste.section == "ABS";
+        entries[i].flags = (ste.local ? SNAPSHOT_LOCAL : 0) | (ste.defined ? SNAPSHOT_DEFINED : 0) | (ste.externn ? SNAPSHOT_EXTERN : 0);
+        names += ste.name;
+    }
+    unsigned int fields[2] = {SNAPSHOT_VERSION, (unsigned int)count};
+    string snapshot = SNAPSHOT_MAGIC;
+    snapshot.append((const char*)fields, sizeof(fields));
+    snapshot.append((const char*)entries.data(), count * sizeof(SnapshotEntry));
+    return snapshot + names;
+}
+
+bool SymbolTable::loadSnapshot(const char* data, size_t size){
+    if(size < 12 || memcmp(data, SNAPSHOT_MAGIC, 4) != 0) return false;
+    unsigned int fields[2];
+    memcpy(fields, data + 4, sizeof(fields));
+    if(fields[0] != SNAPSHOT_VERSION || 12 + (unsigned long long)fields[1] * sizeof(SnapshotEntry) > size) return false;
+    const SnapshotEntry* entries = (const SnapshotEntry*)(data + 12);
+    table.reserve(table.size() + fields[1]);
+    index.reserve(index.size() + fields[1]);
+    for(unsigned int i = 0; i < fields[1]; i++){
+        const SnapshotEntry& entry = entries[i];
+        if((unsigned long long)entry.name_offset + entry.name_length > size) return false;
+        addSymbol(SymbolTableEntry(string(data + entry.name_offset, entry.name_length), entry.abs ? "ABS" : "UND", entry.offset,
+            entry.flags & SNAPSHOT_LOCAL, entry.flags & SNAPSHOT_DEFINED, entry.flags & SNAPSHOT_EXTERN));
+    }
+    return true;
+}
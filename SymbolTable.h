@@ -2,19 +2,28 @@
 #define SYMBOLTABLE_H
 #include "INCLUDES.h"
 #include <vector>
+#include <unordered_map>
+#include <atomic>
+
+#define SNAPSHOT_MAGIC "BGPS"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_LOCAL 0x1 // SnapshotEntry flags
+#define SNAPSHOT_DEFINED 0x2
+#define SNAPSHOT_EXTERN 0x4
 
 struct ForwardReferenceTableEntry{
     int end_of_instruction_offset;
     int byte;
     string section;
     bool pcrel;
+    int size; // bytes of the field, 1 for .byte
 
-    ForwardReferenceTableEntry(int b, string sec, int eoio = 0, bool pcr=false): byte(b), section(sec), end_of_instruction_offset(eoio), pcrel(pcr){}
+    ForwardReferenceTableEntry(int b, string sec, int eoio = 0, bool pcr=false, int sz=2): byte(b), section(sec), end_of_instruction_offset(eoio), pcrel(pcr), size(sz){}
 };
 
 struct SymbolTableEntry{
 public:
-    static int global_id;
+    static atomic<int> global_id; // tools read objects on several threads
     string name;
     int id;
     string section;
@@ -26,8 +35,7 @@ public:
 
     SymbolTableEntry(string n, string s="", short int o=0, bool l=true, bool d=false, bool e=false): 
     name(n), section(s), offset(o), local(l), defined(d), externn(e){
-        id = global_id;
-        global_id += 1;
+        id = global_id++;
         forward_reference_table = {};
     }
 
@@ -37,24 +45,44 @@ public:
 
     void addForwardReference(ForwardReferenceTableEntry frte);
 
-    void resolveSymbol(vector<char>* machine_code, string section_name);
+    void resolveReference(vector<char>* machine_code, const ForwardReferenceTableEntry& frte);
 };
 
-struct find_symbol : std::unary_function<SymbolTableEntry, bool> {
-    string name;
-    find_symbol(string n):name(n) { }
-    bool operator()(SymbolTableEntry const& ste) const {
-        return ste.name == name;
-    }
+/*
+    Snapshot of symbols that belong to no section (.equ constants, externs),
+    written for --emit-prelude: a header with magic, version and entry count,
+    fixed size entries and then the names. Little endian, loaded with one mmap.
+*/
+struct SnapshotEntry{
+    unsigned int name_offset; // from the start of the snapshot
+    unsigned int name_length;
+    short int offset;
+    unsigned char abs; // ABS or UND section
+    unsigned char flags;
+};
+
+struct PendingReference{
+    SymbolTableEntry* symbol;
+    ForwardReferenceTableEntry* reference;
+
+    PendingReference(SymbolTableEntry* s, ForwardReferenceTableEntry* r):symbol(s), reference(r){}
 };
 
 class SymbolTable{
+    private:
+        unordered_map<string, size_t> index; // name -> position in table
+        unordered_map<string, vector<PendingReference>> pending; // section -> forward references of local symbols
     public:
         vector<SymbolTableEntry> table;
         SymbolTableEntry* findSymbol(string symbol);
         void addSymbol(SymbolTableEntry ste);
+        void clear(); // no symbols, table and index keep their capacity
+        void checkDefined(); // exits if some symbol is still undefined and not external
+        void indexForwardReferences(); // groups forward references by section, needed before backpatch
         void backpatch(vector<char>& machine_code, string section_name);
         string toString();
+        string toSnapshot(size_t first); // entries from table[first] on, all in ABS or UND
+        bool loadSnapshot(const char* data, size_t size); // appends the entries, false if data isn't a snapshot
 
         ~SymbolTable(){
             table.clear();
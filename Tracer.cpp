@@ -0,0 +1,41 @@
+#include "Tracer.h"
+#include <unistd.h>
+#include <sys/syscall.h>
+
+Tracer* Tracer::active = nullptr;
+
+Tracer::Tracer(){
+    events = {};
+    origin = chrono::steady_clock::now();
+}
+
+long long Tracer::now(){
+    return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - origin).count();
+}
+
+void Tracer::complete(string name, long long start, string args){
+    long long end = now();
+    int tid = syscall(SYS_gettid);
+    lock_guard<mutex> guard(lock);
+    events.push_back(TraceEvent(name, args, start, end - start, tid));
+}
+
+bool Tracer::write(string fname){
+    ofstream file(fname, ios::out | ios::trunc);
+    if(file.is_open()==false){
+        cerr<<"File "<<fname<< " cannot be opened"<<endl;
+        return false;
+    }
+    int pid = getpid();
+    lock_guard<mutex> guard(lock);
+    file<<"{\"traceEvents\":["<<endl;
+    for(size_t i = 0; i < events.size(); i++){
+        TraceEvent& e = events[i];
+        file<<"{\"name\":"<<Statistics::jsonString(e.name)<<",\"ph\":\"X\",\"ts\":"<<e.start<<",\"dur\":"<<e.duration
+            <<",\"pid\":"<<pid<<",\"tid\":"<<e.tid;
+        if(e.args != "") file<<",\"args\":{"<<e.args<<"}";
+        file<<"}"<<(i+1 < events.size() ? "," : "")<<endl;
+    }
+    file<<"],\"displayTimeUnit\":\"ms\"}"<<endl;
+    return file.good();
+}
@@ -0,0 +1,68 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include "INCLUDES.h"
+#include "Statistics.h"
+#include <vector>
+#include <mutex>
+#include <chrono>
+
+struct TraceEvent{
+    string name;
+    string args; // already formatted JSON object body, may be empty
+    long long start; // microseconds since tracing started
+    long long duration;
+    int tid;
+
+    TraceEvent(string n, string a, long long s, long long d, int t):name(n), args(a), start(s), duration(d), tid(t){}
+};
+
+/*
+    Collects spans in Chrome trace-event format (--trace=<file>), viewable in
+    chrome://tracing or Perfetto. Only one tracer is active per process; when none
+    is, every probe is a single predicted-not-taken branch. Building with
+    -DNO_TRACING turns enabled() into a constant so the probes compile away.
+*/
+class Tracer{
+    private:
+        mutex lock;
+        vector<TraceEvent> events;
+        chrono::steady_clock::time_point origin;
+    public:
+        static Tracer* active;
+
+        Tracer();
+
+#ifdef NO_TRACING
+        static bool enabled(){ return false; }
+#else
+        static bool enabled(){ return __builtin_expect(active != nullptr, 0); }
+#endif
+
+        long long now(); // microseconds since tracing started
+        void complete(string name, long long start, string args=""); // span from start until now, thread safe
+        bool write(string fname);
+};
+
+// span covering the enclosing scope, optionally with one string argument
+class TraceScope{
+    private:
+        const char* name;
+        string args;
+        long long start;
+    public:
+        TraceScope(const char* n):name(n), start(-1){
+            if(Tracer::enabled()) start = Tracer::active->now();
+        }
+        TraceScope(const char* n, const char* key, const string& value):name(n), start(-1){
+            if(Tracer::enabled()){
+                args = Statistics::jsonString(key) + ":" + Statistics::jsonString(value);
+                start = Tracer::active->now();
+            }
+        }
+        ~TraceScope(){
+            if(start >= 0 && Tracer::enabled()) Tracer::active->complete(name, start, args);
+        }
+};
+
+#endif
@@ -0,0 +1,31 @@
+#include "../Archive.h"
+
+/*
+    archiver <archive> <object_file>...
+    archiver --list <archive>
+
+    Bundles objects written by the assembler into one archive with an index of
+    their globals, the linker then only reads members that define symbols it
+    is missing.
+*/
+int main(int argc, char *argv[]){
+    if(argc == 3 && string(argv[1]) == "--list"){
+        Archive archive;
+        if(!archive.open(argv[2])){
+            cout << "ERROR: " << archive.error << endl;
+            return 1;
+        }
+        cout << archive.toString();
+        return 0;
+    }
+    if(argc < 3 || string(argv[1]).find("--") == 0){
+        cout << "Usage: archiver <archive> <object_file>... | archiver --list <archive>" << endl;
+        return -1;
+    }
+    string error = "";
+    if(!Archive::write(argv[1], vector<string>(argv + 2, argv + argc), error)){
+        cout << "ERROR: " << error << endl;
+        return 1;
+    }
+    return 0;
+}
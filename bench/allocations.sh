@@ -0,0 +1,31 @@
+#!/bin/sh
+# Heap allocation counts of the assembler on a generated source.
+#
+#   bench/allocations.sh [results.csv]
+#
+# Builds the assembler with -DALLOC_PROFILE, assembles a generated source of
+# LINES lines (default 100000) and stores allocations, bytes and frees per phase
+# and category in bench/results/<commit>.alloc.csv unless a file is given. The
+# counts are deterministic, so two commits can be compared with diff.
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BUILD=${BUILD:-$ROOT/bench/build}
+LINES=${LINES:-100000}
+
+mkdir -p "$BUILD" "$ROOT/bench/results"
+g++ -O2 -pthread -DALLOC_PROFILE -Wno-deprecated-declarations "$ROOT"/*.cpp -o "$BUILD/main_alloc"
+g++ -O2 "$ROOT/bench/generate.cpp" -o "$BUILD/generate"
+
+COMMIT=$(git -C "$ROOT" rev-parse --short HEAD 2>/dev/null || echo unknown)
+RESULTS=${1:-$ROOT/bench/results/$COMMIT.alloc.csv}
+input="$BUILD/input_$LINES.s"
+[ -f "$input" ] || "$BUILD/generate" "$LINES" 1 "$input"
+
+: > "$BUILD/output.o"
+echo "commit,lines,phase,category,allocations,bytes,frees,freed_bytes" > "$RESULTS"
+"$BUILD/main_alloc" "$input" "$BUILD/output.o" 2>&1 >/dev/null |
+    awk -v commit="$COMMIT" -v lines="$LINES" '
+        NR > 1 && NF == 6 { printf "%s,%d,%s,%s,%s,%s,%s,%s\n", commit, lines, $1, $2, $3, $4, $5, $6 }
+        $1 == "total" { printf "%s,%d,total,,%s,%s,%s,%s\n", commit, lines, $2, $3, $4, $5 }' | tee -a "$RESULTS"
+echo "results written to $RESULTS"
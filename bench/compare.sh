@@ -0,0 +1,23 @@
+#!/bin/sh
+# Compares two bench/run.sh result files phase by phase.
+#
+#   bench/compare.sh old.csv new.csv [threshold_percent]
+#
+# Prints the wall time ratio for every (lines, phase) present in both files and
+# exits with 1 if the total of any size got slower by more than the threshold
+# (default 10%). Phases shorter than a millisecond are too noisy to judge.
+if [ $# -lt 2 ]; then
+    echo "Usage: compare.sh old.csv new.csv [threshold_percent]"
+    exit 2
+fi
+awk -F, -v threshold="${3:-10}" '
+    FNR == 1 { next }
+    NR == FNR { old[$2 "," $4] = $5; next }
+    ($2 "," $4) in old {
+        before = old[$2 "," $4]
+        change = before > 0 ? ($5 - before) / before * 100 : 0
+        mark = ""
+        if ($4 == "total" && before >= 0.001 && change > threshold) { mark = "  REGRESSION"; failed = 1 }
+        printf "%10d %-12s %12.6f %12.6f %+8.1f%%%s\n", $2, $4, before, $5, change, mark
+    }
+    END { exit failed }' "$1" "$2"
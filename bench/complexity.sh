@@ -0,0 +1,77 @@
+#!/bin/sh
+# Growth-rate regression benchmarks on pathological inputs.
+#
+#   bench/complexity.sh
+#
+# Every case from bench/pathological.cpp is assembled at four doubling sizes,
+# and a least squares line is fitted to log(time) over log(n) for every phase.
+# The slope is the growth exponent: 1 is linear, n log n is about 1.1 over these
+# ranges, and 2 is quadratic. The script fails if any exponent exceeds LIMIT
+# (default 1.5). The slack above n log n is for phases that do random lookups in
+# tables that outgrow the caches, they measure up to ~1.4 while being linear in
+# operations. Phases that stay under MIN_TIME seconds (default 0.005) even at the
+# largest size are noise and are not judged.
+#
+# Environment: CASES, LIMIT, MIN_TIME, BUILD, SCALE (multiplies all sizes).
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BUILD=${BUILD:-$ROOT/bench/build}
+CASES=${CASES:-"labels equ_chain forward_refs sections relocations"}
+LIMIT=${LIMIT:-1.5}
+MIN_TIME=${MIN_TIME:-0.005}
+SCALE=${SCALE:-1}
+
+mkdir -p "$BUILD"
+g++ -O2 -pthread -Wno-deprecated-declarations "$ROOT"/*.cpp -o "$BUILD/main" || exit 2
+g++ -O2 "$ROOT/bench/pathological.cpp" -o "$BUILD/pathological" || exit 2
+
+base_size(){
+    case $1 in
+        labels) echo 12500 ;;       # up to 100k labels
+        equ_chain) echo 1250 ;;     # up to 10k deep
+        forward_refs) echo 12500 ;;
+        sections) echo 100 ;;       # up to 800 sections
+        relocations) echo 25000 ;;
+    esac
+}
+
+failed=0
+for c in $CASES; do
+    base=$(( $(base_size "$c") * SCALE ))
+    points=""
+    for k in 1 2 4 8; do
+        n=$((base * k))
+        "$BUILD/pathological" "$c" "$n" "$BUILD/$c.s" || exit 2
+        : > "$BUILD/$c.o"
+        json=$("$BUILD/main" --stats=json "$BUILD/$c.s" "$BUILD/$c.o" 2>&1 >/dev/null)
+        phases=$(echo "$json" | grep -o '"[a-z_]*":{"wall":[^,]*' | sed 's/[{"]//g; s/:wall:/=/')
+        total=$(echo "$phases" | cut -d= -f2 | awk '{ s += $1 } END { print s }')
+        points="$points $n:$(echo $phases | tr ' ' ','),total=$total"
+    done
+    echo "$points" | tr ' ' '\n' | awk -F'[:,=]' -v name="$c" -v limit="$LIMIT" -v min_time="$MIN_TIME" '
+        NF == 0 { next }
+        {
+            n = $1
+            for (i = 2; i < NF; i += 2) {
+                phase = $i; t = $(i+1)
+                if (!(phase in seen)) { seen[phase] = 1; order[++count] = phase }
+                if (t < 1e-7) t = 1e-7
+                x = log(n); y = log(t)
+                sx[phase] += x; sy[phase] += y; sxx[phase] += x*x; sxy[phase] += x*y; m[phase]++
+                last[phase] = t
+            }
+        }
+        END {
+            printf "%s\n", name
+            for (j = 1; j <= count; j++) {
+                p = order[j]
+                slope = (m[p]*sxy[p] - sx[p]*sy[p]) / (m[p]*sxx[p] - sx[p]*sx[p])
+                verdict = "ok"
+                if (last[p] < min_time) verdict = "too fast to judge"
+                else if (slope > limit) { verdict = "SUPERLINEAR"; bad = 1 }
+                printf "  %-12s exponent %5.2f  largest %9.4f s  %s\n", p, slope, last[p], verdict
+            }
+            exit bad
+        }' || failed=1
+done
+exit $failed
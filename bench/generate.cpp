@@ -0,0 +1,196 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <stdlib.h>
+
+using namespace std;
+
+/*
+    Synthetic source generator for benchmarks.
+
+    generate <lines> [seed] [output_file]
+
+    Produces a valid program of roughly <lines> lines: all 25 instructions in every
+    addressing mode they accept, byte and word variants, labels referenced forwards and
+    backwards across sections, .equ chains (including ones that need resolveUST),
+    .word/.byte tables, .skip, comments and blank lines. Same arguments give the same
+    output on every machine.
+*/
+
+struct Mnemonic{
+    string name;
+    int operands;
+    bool jump;
+};
+
+static const vector<Mnemonic> mnemonics = {
+    {"halt", 0, false}, {"iret", 0, false}, {"ret", 0, false},
+    {"int", 1, true}, {"call", 1, true}, {"jmp", 1, true}, {"jeq", 1, true}, {"jne", 1, true}, {"jgt", 1, true},
+    {"push", 1, false}, {"pop", 1, false},
+    {"xchg", 2, false}, {"mov", 2, false}, {"add", 2, false}, {"sub", 2, false}, {"mul", 2, false},
+    {"div", 2, false}, {"cmp", 2, false}, {"not", 2, false}, {"and", 2, false}, {"or", 2, false},
+    {"xor", 2, false}, {"test", 2, false}, {"shl", 2, false}, {"shr", 2, false}
+};
+
+static const int LINES_PER_SECTION = 4000; // keeps every section well inside 16 bit offsets
+static const int LINES_PER_LABEL = 8;
+static const int EQU_CHAIN = 16;
+
+class Generator{
+    private:
+        mt19937 rng;
+        long long total_labels;
+        long long equ_count;
+        int extern_count;
+
+        int pick(int n){ return uniform_int_distribution<int>(0, n-1)(rng); }
+
+        string label(long long i){ return "L" + to_string(i); }
+        string anySymbol(){
+            int r = pick(10);
+            if(r == 0) return "ext" + to_string(pick(extern_count));
+            if(r == 1) return "e" + to_string(pick(equ_count));
+            return label(uniform_int_distribution<long long>(0, total_labels-1)(rng));
+        }
+        string literal(){
+            switch(pick(3)){
+                case 0: return to_string(pick(200));
+                case 1: {
+                    char buffer[16];
+                    snprintf(buffer, sizeof(buffer), "0x%x", pick(0x7fff));
+                    return buffer;
+                }
+                default: return "-" + to_string(1 + pick(100));
+            }
+        }
+        string reg(){ return "%r" + to_string(pick(6)); }
+
+        // operand of a data instruction, mode as in Op descriptor AM bits
+        string dataOperand(int mode, bool byte_size){
+            switch(mode){
+                case 0: return "$" + (pick(2) ? literal() : anySymbol());
+                case 1: return byte_size ? reg() + (pick(2) ? "h" : "l") : reg();
+                case 2: return "(" + reg() + ")";
+                case 3:
+                    if(pick(3) == 0) return label(uniform_int_distribution<long long>(0, total_labels-1)(rng)) + "(%pc)";
+                    return (pick(2) ? to_string(pick(64)) : anySymbol()) + "(" + reg() + ")";
+                default: return pick(2) ? "0x" + to_string(100 + pick(800)) : anySymbol();
+            }
+        }
+
+        string jumpOperand(){
+            switch(pick(6)){
+                case 0: return pick(2) ? to_string(pick(1000)) : anySymbol();
+                case 1: return "*" + reg();
+                case 2: return "*(" + reg() + ")";
+                case 3: return "*" + to_string(pick(64)) + "(" + reg() + ")";
+                case 4: return "*" + label(uniform_int_distribution<long long>(0, total_labels-1)(rng)) + "(%pc)";
+                default: return "*" + anySymbol();
+            }
+        }
+
+        string instruction(){
+            const Mnemonic& m = mnemonics[pick(mnemonics.size())];
+            if(m.operands == 0) return m.name;
+            if(m.jump) return m.name + " " + jumpOperand();
+            bool byte_size = pick(4) == 0;
+            string name = m.name + (byte_size ? "b" : (pick(4) == 0 ? "w" : ""));
+            if(m.operands == 1){
+                int mode = pick(5);
+                if(m.name == "pop" && mode == 0) mode = 1; // destination can't be immediate
+                return name + " " + dataOperand(mode, byte_size);
+            }
+            int src = pick(5), dst = 1 + pick(4);
+            if((m.name == "xchg" || m.name == "shr") && src == 0) src = 1;
+            return name + " " + dataOperand(src, byte_size) + ", " + dataOperand(dst, byte_size);
+        }
+
+        string directive(){
+            switch(pick(4)){
+                case 0: {
+                    string line = ".word " + literal();
+                    for(int i = 0, n = pick(6); i < n; i++) line += ", " + (pick(2) ? literal() : anySymbol());
+                    return line;
+                }
+                case 1: {
+                    string line = ".byte " + to_string(pick(256));
+                    for(int i = 0, n = pick(12); i < n; i++) line += ", " + to_string(pick(256));
+                    return line;
+                }
+                case 2: return ".skip " + to_string(1 + pick(8));
+                default: return ".word " + anySymbol();
+            }
+        }
+    public:
+        Generator(unsigned seed):rng(seed){}
+
+        void generate(long long lines, ostream& out){
+            long long sections = lines / LINES_PER_SECTION + 1;
+            total_labels = lines / LINES_PER_LABEL + 1;
+            equ_count = (lines / 200 / EQU_CHAIN + 1) * EQU_CHAIN;
+            extern_count = 8;
+
+            out<<"# generated by bench/generate, "<<lines<<" lines"<<endl;
+            out<<".extern ext0";
+            for(int i = 1; i < extern_count; i++) out<<", ext"<<i;
+            out<<endl<<".global L0";
+            long long step = total_labels/64 + 1;
+            for(long long i = step; i < total_labels; i += step) out<<", "<<label(i);
+            out<<endl;
+
+            // half of every chain is defined in order, the other half refers forward and goes through resolveUST
+            out<<".section .data0"<<endl;
+            for(long long c = 0; c < equ_count; c += EQU_CHAIN){
+                out<<".equ e"<<c<<", "<<pick(100)<<endl;
+                for(int i = 1; i < EQU_CHAIN/2; i++) out<<".equ e"<<c+i<<", e"<<c+i-1<<"+"<<pick(10)<<endl;
+                for(int i = EQU_CHAIN/2; i < EQU_CHAIN-1; i++) out<<".equ e"<<c+i<<", e"<<c+i+1<<"-"<<pick(10)<<endl;
+                out<<".equ e"<<c+EQU_CHAIN-1<<", e"<<c<<"+0x10"<<endl;
+            }
+
+            long long next_label = 0;
+            long long line = equ_count + 4;
+            for(long long s = 0; s < sections; s++){
+                out<<".section .s"<<s<<endl;
+                long long section_end = (s+1 == sections) ? lines : line + LINES_PER_SECTION;
+                long long labels_left = total_labels - next_label;
+                long long labels_here = (s+1 == sections) ? labels_left : min(labels_left, (long long)LINES_PER_SECTION / LINES_PER_LABEL);
+                long long defined_here = 0;
+                for(; line < section_end || defined_here < labels_here; line++){
+                    if(defined_here < labels_here && (line % LINES_PER_LABEL == 0 || line >= section_end)){
+                        out<<label(next_label++)<<":"<<(pick(2) ? " " : "")<<endl;
+                        defined_here++;
+                        continue;
+                    }
+                    int r = pick(100);
+                    if(r < 70) out<<"    "<<instruction()<<(pick(10) == 0 ? " # comment" : "")<<endl;
+                    else if(r < 92) out<<"    "<<directive()<<endl;
+                    else if(r < 96) out<<"# full line comment"<<endl;
+                    else out<<endl;
+                }
+            }
+            out<<".end"<<endl;
+        }
+};
+
+int main(int argc, char* argv[]){
+    if(argc < 2){
+        cout<<"Usage: generate <lines> [seed] [output_file]"<<endl;
+        return -1;
+    }
+    long long lines = atoll(argv[1]);
+    unsigned seed = argc > 2 ? atoi(argv[2]) : 1;
+    Generator generator(seed);
+    if(argc > 3){
+        ofstream out(argv[3], ios::out | ios::trunc);
+        if(out.is_open()==false){
+            cout<<"File "<<argv[3]<<" cannot be opened"<<endl;
+            return -1;
+        }
+        generator.generate(lines, out);
+        return 0;
+    }
+    generator.generate(lines, cout);
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <stdlib.h>
+
+using namespace std;
+
+/*
+    Worst case inputs for complexity benchmarks.
+
+    pathological <case> <n> <output_file>
+
+    labels       - n distinct labels, each referencing another one forwards or backwards
+    equ_chain    - n deep .equ chain written in reverse, so every link waits for the next
+    forward_refs - n forward references to a single symbol
+    sections     - n sections with a couple of cross section references each
+    relocations  - n relocation producing operands, half of them PC relative in the same section
+*/
+
+static const int LABELS_PER_SECTION = 8192; // keeps offsets inside 16 bits
+
+static void labels(long long n, ostream& out){
+    for(long long i = 0; i < n; i++){
+        if(i % LABELS_PER_SECTION == 0) out<<".section .t"<<i / LABELS_PER_SECTION<<endl;
+        out<<"l"<<i<<": .word l"<<(i * 7919 + 13) % n<<endl;
+    }
+}
+
+static void equChain(long long n, ostream& out){
+    out<<".section .text"<<endl;
+    for(long long i = 0; i < n-1; i++) out<<".equ c"<<i<<", c"<<i+1<<"+1"<<endl;
+    out<<".equ c"<<n-1<<", 1"<<endl;
+    out<<".word c0"<<endl;
+}
+
+static void forwardRefs(long long n, ostream& out){
+    for(long long i = 0; i < n; i++){
+        if(i % LABELS_PER_SECTION == 0) out<<".section .t"<<i / LABELS_PER_SECTION<<endl;
+        out<<(i % 2 ? "jmp target" : "mov target, %r1")<<endl;
+    }
+    out<<"target: halt"<<endl;
+}
+
+static void sections(long long n, ostream& out){
+    for(long long i = 0; i < n; i++){
+        out<<".section .s"<<i<<endl;
+        out<<"a"<<i<<": .word a"<<(i+1) % n<<", b"<<i<<endl;
+        out<<"jmp b"<<(i * 31 + 7) % n<<endl;
+        out<<"b"<<i<<": halt"<<endl;
+    }
+}
+
+static void relocations(long long n, ostream& out){
+    for(long long i = 0; i < n; i++){
+        if(i % LABELS_PER_SECTION == 0) out<<".section .t"<<i / LABELS_PER_SECTION<<endl;
+        if(i % 2) out<<"x"<<i<<": mov x"<<i<<"(%pc), %r1"<<endl;
+        else out<<"x"<<i<<": .word x"<<i<<", ext"<<endl;
+    }
+}
+
+int main(int argc, char* argv[]){
+    if(argc != 4){
+        cout<<"Usage: pathological <labels|equ_chain|forward_refs|sections|relocations> <n> <output_file>"<<endl;
+        return -1;
+    }
+    string kind = argv[1];
+    long long n = atoll(argv[2]);
+    ofstream out(argv[3], ios::out | ios::trunc);
+    if(out.is_open()==false){
+        cout<<"File "<<argv[3]<<" cannot be opened"<<endl;
+        return -1;
+    }
+    out<<".extern ext"<<endl;
+    if(kind == "labels") labels(n, out);
+    else if(kind == "equ_chain") equChain(n, out);
+    else if(kind == "forward_refs") forwardRefs(n, out);
+    else if(kind == "sections") sections(n, out);
+    else if(kind == "relocations") relocations(n, out);
+    else {
+        cout<<"Unknown case "<<kind<<endl;
+        return -1;
+    }
+    out<<".end"<<endl;
+    return 0;
+}
@@ -0,0 +1,52 @@
+#!/bin/sh
+# Throughput benchmark of the assembler on generated sources.
+#
+#   bench/run.sh [results.csv]
+#
+# Environment: SIZES (source lines, default "1000 10000 100000 1000000"; add
+# 10000000 for the large run), RUNS (repetitions per size, fastest one is kept),
+# BUILD (scratch directory). Results go to bench/results/<commit>.csv unless a
+# file is given; compare two result files with bench/compare.sh.
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BUILD=${BUILD:-$ROOT/bench/build}
+SIZES=${SIZES:-"1000 10000 100000 1000000"}
+RUNS=${RUNS:-3}
+
+mkdir -p "$BUILD" "$ROOT/bench/results"
+g++ -O2 -pthread -Wno-deprecated-declarations "$ROOT"/*.cpp -o "$BUILD/main"
+g++ -O2 "$ROOT/bench/generate.cpp" -o "$BUILD/generate"
+
+COMMIT=$(git -C "$ROOT" rev-parse --short HEAD 2>/dev/null || echo unknown)
+RESULTS=${1:-$ROOT/bench/results/$COMMIT.csv}
+echo "commit,lines,bytes,phase,wall_s,cpu_s,lines_per_s,mb_per_s,peak_rss_kb" > "$RESULTS"
+
+for n in $SIZES; do
+    input="$BUILD/input_$n.s"
+    [ -f "$input" ] || "$BUILD/generate" "$n" 1 "$input"
+    bytes=$(wc -c < "$input")
+    best=""
+    best_total=""
+    run=0
+    while [ $run -lt "$RUNS" ]; do
+        : > "$BUILD/output.o"
+        json=$("$BUILD/main" --stats=json "$input" "$BUILD/output.o" 2>&1 >/dev/null)
+        total=$(echo "$json" | grep -o '"wall":[^,]*' | cut -d: -f2 | awk '{ s += $1 } END { print s }')
+        if [ -z "$best" ] || awk "BEGIN { exit !($total < $best_total) }"; then
+            best="$json"
+            best_total="$total"
+        fi
+        run=$((run + 1))
+    done
+    echo "$best" | grep -o '"[a-z_]*":{"wall":[^}]*}' | sed 's/[{}"]//g; s/:wall:/,/; s/,cpu:/,/; s/,peak_rss_kb:/,/' |
+    awk -F, -v commit="$COMMIT" -v lines="$n" -v bytes="$bytes" -v total="$best_total" '
+        function row(phase, wall, cpu, rss) {
+            lps = wall > 0 ? lines / wall : 0
+            mbps = wall > 0 ? bytes / 1048576 / wall : 0
+            printf "%s,%d,%d,%s,%.6f,%.6f,%.0f,%.2f,%d\n", commit, lines, bytes, phase, wall, cpu, lps, mbps, rss
+        }
+        { row($1, $2, $3, $4); cpu_total += $3; if ($4 > rss) rss = $4 }
+        END { row("total", total, cpu_total, rss) }' | tee -a "$RESULTS"
+done
+echo "results written to $RESULTS"
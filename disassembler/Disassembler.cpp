@@ -0,0 +1,272 @@
+#include "Disassembler.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <unordered_map>
+
+// same order as Assembler::instruction_set, index is the OC
+static const char* MNEMONICS[] = {
+    "halt", "iret", "ret",
+    "int", "call", "jmp", "jeq", "jne", "jgt", "push", "pop",
+    "xchg", "mov", "add", "sub", "mul", "div", "cmp", "not", "and", "or", "xor", "test", "shl", "shr"
+};
+#define LAST_OPCODE 0x18
+
+InstructionDescriptor Disassembler::instructions[256];
+OperandDescriptor Disassembler::operands[256];
+bool Disassembler::tables_built = false;
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+static void appendHex(string& out, unsigned int value, int width){
+    for(int shift = (width - 1) * 4; shift >= 0; shift -= 4) out += HEX_DIGITS[(value >> shift) & 0xF];
+}
+
+static void appendNumber(string& out, unsigned int value){
+    out += "0x";
+    int width = 1;
+    while(width < 4 && (value >> (width * 4)) != 0) width++;
+    appendHex(out, value, width);
+}
+
+static unsigned short read16(const vector<char>& code, size_t at){
+    return (unsigned char)code[at] | ((unsigned char)code[at+1] << 8); // little endian
+}
+
+void Disassembler::buildTables(){
+    /*
+        Only what dealWithInstruction writes is valid: unused bits are 0,
+        instructions without operands have S = 0, a register is named only in
+        modes 0x1 - 0x3 (0xA otherwise) and L/H is only set in mode 0x1.
+    */
+    for(int byte = 0; byte < 256; byte++){
+        InstructionDescriptor& instruction = instructions[byte];
+        int opcode = byte >> 3;
+        instruction.mnemonic = nullptr;
+        instruction.size = (byte & 0x4) ? 2 : 1;
+        if(opcode <= LAST_OPCODE && (byte & 0x3) == 0){
+            instruction.operands = opcode <= 0x02 ? 0 : opcode <= 0x0A ? 1 : 2;
+            if(instruction.operands > 0 || instruction.size == 1) instruction.mnemonic = MNEMONICS[opcode];
+        }
+        instruction.jump = opcode >= 0x03 && opcode <= 0x08;
+        // immediate destinations are rejected by the assembler, cmp, test and shr only read the second operand
+        instruction.immediate = 0x3;
+        if(opcode == 0x0A) instruction.immediate = 0x0;
+        if(opcode >= 0x0B && opcode != 0x11 && opcode != 0x16 && opcode != 0x18) instruction.immediate = 0x1;
+        if(opcode == 0x0B) instruction.immediate = 0x0;
+        if(opcode == 0x18) instruction.immediate = 0x2;
+
+        OperandDescriptor& operand = operands[byte];
+        operand.mode = byte >> 5;
+        operand.reg = (byte >> 1) & 0xF;
+        operand.high = byte & 0x1;
+        bool uses_register = operand.mode >= 0x1 && operand.mode <= 0x3;
+        operand.valid = operand.mode <= 0x4 && (uses_register ? operand.reg <= 7 : operand.reg == 0xA) && (operand.mode == 0x1 || !operand.high);
+        operand.field[0] = operand.mode == 0x0 ? 1 : operand.mode >= 0x3 ? 2 : 0;
+        operand.field[1] = operand.mode == 0x0 ? 2 : operand.field[0];
+    }
+    tables_built = true;
+}
+
+Disassembler::Disassembler(){
+    static mutex build_lock;
+    lock_guard<mutex> lock(build_lock);
+    if(!tables_built) buildTables();
+}
+
+string Disassembler::section(Section* section, vector<Label>& labels){
+    const vector<char>& code = section->machine_code;
+    stable_sort(labels.begin(), labels.end(), [](const Label& a, const Label& b){ return a.offset < b.offset; });
+    vector<RelocationTableEntry*> relocations = {};
+    for(RelocationTableEntry& rte: section->relocation_table) relocations.push_back(&rte);
+    stable_sort(relocations.begin(), relocations.end(), [](RelocationTableEntry* a, RelocationTableEntry* b){ return a->offset < b->offset; });
+
+    string out = "";
+    out.reserve(code.size() * 12 + 64);
+    out += ".section ";
+    out += section->name;
+    if(section->flags != SECTION_DEFAULT_FLAGS){
+        out += ", \"";
+        if(section->flags & SECTION_WRITE) out += 'w';
+        if(section->flags & SECTION_EXEC) out += 'x';
+        out += section->nobits() ? "\", @nobits" : "\"";
+    }
+    out += '\n';
+    if(section->nobits()){ // labels and the space between them
+        int at = 0;
+        for(Label& label: labels){
+            if(label.offset > at){
+                out += ".skip " + to_string(label.offset - at) + "\n";
+                at = label.offset;
+            }
+            out += label.name + ":\n";
+        }
+        if(section->location_counter > at) out += ".skip " + to_string(section->location_counter - at) + "\n";
+        return out;
+    }
+    vector<LineRow> rows = {};
+    section->decodeLines(rows); // empty unless assembled with -g, a truncated table keeps the rows before the cut
+    size_t next_label = 0, next_relocation = 0, next_row = 0;
+    size_t fields[2]; // offsets of the operand fields of the current instruction, 0 if none
+    size_t at = 0;
+    while(at < code.size()){
+        for(; next_label < labels.size() && labels[next_label].offset <= at; next_label++){
+            out += labels[next_label].name;
+            out += ":\n";
+        }
+        size_t limit = next_label < labels.size() ? labels[next_label].offset : code.size(); // instructions don't run across labels
+        const InstructionDescriptor& instruction = instructions[(unsigned char)code[at]];
+        size_t length = 1;
+        bool valid = instruction.mnemonic != nullptr;
+        for(int i = 0; valid && i < instruction.operands; i++){
+            fields[i] = 0;
+            if(at + length >= limit){
+                valid = false;
+                break;
+            }
+            const OperandDescriptor& operand = operands[(unsigned char)code[at + length]];
+            valid = operand.valid && (operand.mode != 0x0 || (instruction.immediate >> i & 1)) && !(operand.high && instruction.size == 2);
+            length++;
+            if(operand.field[instruction.size - 1] > 0) fields[i] = at + length;
+            length += operand.field[instruction.size - 1];
+            if(at + length > limit) valid = false;
+        }
+        size_t line_start = out.size();
+        string comment = "";
+        // source line where a row starts, rows starting inside an instruction are passed over
+        for(; next_row < rows.size() && (size_t)rows[next_row].address <= at; next_row++){
+            if((size_t)rows[next_row].address == at) comment = "line " + to_string(rows[next_row].line);
+        }
+        if(!valid){
+            // a byte nothing decodes, sweep on from the next one
+            out += "    .byte ";
+            appendNumber(out, (unsigned char)code[at]);
+            length = 1;
+        }else{
+            out += "    ";
+            out += instruction.mnemonic;
+            if(instruction.operands > 0 && instruction.size == 1) out += 'b';
+            size_t field_at = at + 1;
+            for(int i = 0; i < instruction.operands; i++){
+                const OperandDescriptor& operand = operands[(unsigned char)code[field_at++]];
+                out += i == 0 ? " " : ", ";
+                unsigned int value = 0;
+                if(operand.field[instruction.size - 1] == 1) value = (unsigned char)code[field_at];
+                else if(operand.field[instruction.size - 1] == 2) value = read16(code, field_at);
+                field_at += operand.field[instruction.size - 1];
+                if(instruction.jump && operand.mode != 0x0) out += '*';
+                switch(operand.mode){
+                    case 0x0:
+                        if(!instruction.jump) out += '$';
+                        appendNumber(out, value);
+                        break;
+                    case 0x1:
+                        out += "%r";
+                        out += (char)('0' + operand.reg);
+                        if(instruction.size == 1) out += operand.high ? 'h' : 'l';
+                        break;
+                    case 0x2:
+                        out += "(%r";
+                        out += (char)('0' + operand.reg);
+                        out += ')';
+                        break;
+                    case 0x3:
+                        appendNumber(out, value);
+                        out += "(%r";
+                        out += (char)('0' + operand.reg);
+                        out += ')';
+                        break;
+                    case 0x4:
+                        appendNumber(out, value);
+                        break;
+                }
+                // field holds the addend: R_386_16 refers to symbol + addend, R_386_PC16 to symbol + addend + distance from the field to the next instruction
+                bool relocated = false;
+                while(fields[i] != 0 && next_relocation < relocations.size() && (size_t)relocations[next_relocation]->offset <= fields[i]){
+                    RelocationTableEntry* rte = relocations[next_relocation++];
+                    if((size_t)rte->offset != fields[i]) continue;
+                    relocated = true;
+                    int addend = (short)value;
+                    if(rte->type == "R_386_PC16") addend += at + length - fields[i];
+                    if(comment != "") comment += ", ";
+                    comment += rte->symbol_name;
+                    if(addend != 0){
+                        comment += addend > 0 ? "+" : "-";
+                        appendNumber(comment, addend > 0 ? addend : -addend);
+                    }
+                }
+                // PC relative within the section needs no relocation, name the label it lands on
+                if(!relocated && operand.mode == 0x3 && operand.reg == 7){
+                    unsigned short target = at + length + value;
+                    vector<Label>::iterator it = lower_bound(labels.begin(), labels.end(), target, [](const Label& a, unsigned short b){ return a.offset < b; });
+                    if(it != labels.end() && it->offset == target){
+                        if(comment != "") comment += ", ";
+                        comment += it->name;
+                    }
+                }
+            }
+        }
+        // source on the left, address and bytes as a comment
+        size_t width = out.size() - line_start;
+        if(width < 36) out.append(36 - width, ' ');
+        else out += ' ';
+        out += "# ";
+        appendHex(out, at, 4);
+        out += ':';
+        for(size_t i = at; i < at + length; i++){
+            out += ' ';
+            appendHex(out, (unsigned char)code[i], 2);
+        }
+        if(comment != ""){
+            out += "  ";
+            out += comment;
+        }
+        out += '\n';
+        at += length;
+    }
+    for(; next_label < labels.size(); next_label++){
+        out += labels[next_label].name;
+        out += ":\n";
+    }
+    return out;
+}
+
+string Disassembler::disassemble(ObjectFile& object){
+    vector<string> parts(object.sections.size());
+    // symbols are split by section once, not searched for every section
+    unordered_map<string, vector<Label>> labels = {};
+    for(Section* section: object.sections) labels[section->name] = {};
+    for(SymbolTableEntry& ste: object.st->table){
+        unordered_map<string, vector<Label>>::iterator it = labels.find(ste.section);
+        if(it != labels.end() && ste.name != ste.section) it->second.push_back(Label{(unsigned short)ste.offset, ste.name});
+    }
+    // sections are independent, the calling thread is a worker too
+    atomic<size_t> next(0);
+    auto worker = [&](){
+        for(size_t i = next++; i < parts.size(); i = next++) parts[i] = section(object.sections[i], labels.find(object.sections[i]->name)->second);
+    };
+    size_t worker_count = thread::hardware_concurrency();
+    if(worker_count > parts.size()) worker_count = parts.size();
+    vector<thread> workers = {};
+    for(size_t i = 1; i < worker_count; i++) workers.push_back(thread(worker));
+    worker();
+    for(thread& t: workers) t.join();
+
+    string out = "";
+    for(SymbolTableEntry& ste: object.st->table){
+        if(ste.local) continue;
+        out += ste.section == "UND" ? ".extern " : ".global ";
+        out += ste.name;
+        out += '\n';
+    }
+    for(SymbolTableEntry& ste: object.st->table){
+        if(ste.section != "ABS" || ste.name == "ABS") continue;
+        out += ".equ " + ste.name + ", ";
+        appendNumber(out, (unsigned short)ste.offset);
+        out += '\n';
+    }
+    for(string& part: parts) out += part;
+    out += ".end\n";
+    return out;
+}
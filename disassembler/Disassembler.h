@@ -0,0 +1,58 @@
+#ifndef DISASSEMBLER_H
+#define DISASSEMBLER_H
+
+#include "../INCLUDES.h"
+#include "../ObjectFile.h"
+#include <vector>
+
+struct InstructionDescriptor{
+    const char* mnemonic; // null for bytes dealWithInstruction never writes as InstrDescr
+    unsigned char operands;
+    unsigned char size; // operand size in bytes, 1 or 2
+    bool jump; // flow control operand syntax, *%r1 instead of %r1
+    unsigned char immediate; // bit i set if operand i may be immediate
+};
+
+struct OperandDescriptor{
+    bool valid; // false for bytes dealWithInstruction never writes as OpDescr
+    unsigned char mode; // addressing mode, 0x0 - 0x4
+    unsigned char reg;
+    unsigned char high; // L/H bit, only written for byte sized register direct operands
+    unsigned char field[2]; // operand field bytes for byte and word sized instructions
+};
+
+struct Label{
+    unsigned short offset;
+    string name;
+};
+
+/*
+    Turns machine code written by Assembler::end() back into source lines.
+
+    Every byte value is looked up in two 256 entry tables built once: what it
+    means as an InstrDescr (mnemonic, operand count, size) and as an OpDescr
+    (addressing mode, register, L/H and how many field bytes follow), so the
+    sweep does no bit fiddling or validation of its own. A byte sequence that
+    dealWithInstruction could not have written is printed as .byte, which
+    keeps the output valid input for the assembler: assembling it gives the
+    same machine code.
+
+    Symbols of the section become labels, relocated fields and PC relative
+    operands get the symbol they refer to as a comment. Sections are
+    disassembled on all cores.
+*/
+class Disassembler{
+    private:
+        static InstructionDescriptor instructions[256];
+        static OperandDescriptor operands[256];
+        static bool tables_built;
+
+        static void buildTables();
+        string section(Section* section, vector<Label>& labels); // labels of the section, sorted here
+    public:
+        Disassembler();
+
+        string disassemble(ObjectFile& object); // every section of an object read by ObjectFile
+};
+
+#endif
@@ -0,0 +1,41 @@
+#include "Disassembler.h"
+#include "../FileManager.h"
+
+/*
+    disassembler [-o <output_file>] <object_file>
+
+    Prints the sections of an object written by the assembler as source that
+    assembles back into the same machine code, with labels from the symbol
+    table and the symbols of relocated fields as comments.
+*/
+int main(int argc, char *argv[]){
+    string input = "";
+    string output = "-";
+    for(int i = 1; i < argc; i++){
+        string arg = argv[i];
+        if(arg == "-o" && i + 1 < argc) output = argv[++i];
+        else if(arg.find("--") == 0){
+            cout << "ERROR: Unknown option " << arg << endl;
+            return -1;
+        }
+        else if(input == "") input = arg;
+        else {
+            cout << "ERROR: Only one object file can be disassembled." << endl;
+            return -1;
+        }
+    }
+    if(input == ""){
+        cout << "Usage: disassembler [-o <output_file>] <object_file>" << endl;
+        return -1;
+    }
+
+    ObjectFile object;
+    if(!object.read(input) || !object.decodeAll()){
+        cout << "ERROR: " << object.error << endl;
+        return 1;
+    }
+    Disassembler disassembler;
+    FileManager fm;
+    fm.setContent(disassembler.disassemble(object), output);
+    return 0;
+}
@@ -0,0 +1,399 @@
+#include "Emulator.h"
+#include <sstream>
+#include <iomanip>
+
+static const unsigned char OPERAND_COUNT[] = {
+    0, 0, 0, // halt, iret, ret
+    1, 1, 1, 1, 1, 1, 1, 1, // int, call, jmp, jeq, jne, jgt, push, pop
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2 // xchg ... shr
+};
+static const unsigned char STACK_CYCLES[] = {0, 2, 1, 3, 1, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+#define LAST_OPCODE 0x18
+
+static string hex(unsigned int value){
+    stringstream ss;
+    ss<<"0x"<<setw(4)<<setfill('0')<<std::hex<<value;
+    return ss.str();
+}
+
+Emulator::Emulator(){
+    fill(memory, memory + MEMORY_SIZE, 0);
+    decoded = vector<DecodedInstruction>(MEMORY_SIZE);
+    code_pages = vector<unsigned char>(MEMORY_SIZE >> PAGE_BITS, 0);
+    executable = vector<unsigned char>(MEMORY_SIZE, 1);
+    reset();
+}
+
+void Emulator::reset(){
+    for(int i = 0; i < 16; i++) r[i] = 0;
+    r[REG_SP] = 0; // first push goes to 0xFFFE
+    instructions = 0;
+    cycles = 0;
+    error = "";
+    for(DecodedInstruction& instruction: decoded) instruction.length = 0;
+    fill(code_pages.begin(), code_pages.end(), 0);
+}
+
+int Emulator::fail(string message){
+    error = message;
+    return EMULATOR_FAULT;
+}
+
+bool Emulator::load(ObjectFile& object, unsigned short base){
+    unsigned int next = base;
+    if(!object.decodeAll()){
+        fail(object.error);
+        return false;
+    }
+    section_addresses.clear();
+    symbol_addresses.clear();
+    fill(executable.begin(), executable.end(), 1);
+    for(Section* section: object.sections){
+        // location_counter is the size, also of nobits sections that have no machine code
+        if(next + section->location_counter > MEMORY_SIZE){
+            fail("Section " + section->name + " doesn't fit into memory.");
+            return false;
+        }
+        section_addresses[section->name] = next;
+        if(section->nobits()) fill(memory + next, memory + next + section->location_counter, 0);
+        else copy(section->machine_code.begin(), section->machine_code.end(), memory + next);
+        if(!(section->flags & SECTION_EXEC)) fill(executable.begin() + next, executable.begin() + next + section->location_counter, 0);
+        next += section->location_counter;
+    }
+    for(SymbolTableEntry& ste: object.st->table){
+        if(ste.section == "ABS") symbol_addresses[ste.name] = ste.offset;
+        else if(section_addresses.find(ste.section) != section_addresses.end()) symbol_addresses[ste.name] = section_addresses[ste.section] + ste.offset;
+    }
+    // field holds the addend: R_386_16 and R_386_8 add the symbol address, R_386_PC16 the distance from the field to it
+    for(Section* section: object.sections){
+        unsigned short section_address = section_addresses[section->name];
+        for(RelocationTableEntry& rte: section->relocation_table){
+            SymbolTableEntry* ste = object.findSymbolById(rte.value);
+            bool byte = rte.type == "R_386_8";
+            if(rte.offset < 0 || rte.offset + (byte ? 1 : 2) > (int)section->machine_code.size()){
+                fail("Relocation outside of section " + section->name + ".");
+                return false;
+            }
+            if(ste->section != "ABS" && section_addresses.find(ste->section) == section_addresses.end()){
+                fail("Unresolved symbol " + ste->name + ", link the object first.");
+                return false;
+            }
+            unsigned short symbol = (ste->section == "ABS" ? 0 : section_addresses[ste->section]) + ste->offset;
+            unsigned short place = section_address + rte.offset;
+            if(byte){
+                memory[place] += symbol;
+                continue;
+            }
+            unsigned short value = read16(place) + symbol - (rte.type == "R_386_PC16" ? place : 0);
+            memory[place] = value & 0xFF;
+            memory[(unsigned short)(place+1)] = value >> 8;
+        }
+    }
+    reset();
+    r[REG_PC] = base;
+    return true;
+}
+
+bool Emulator::symbolAddress(string name, unsigned short& address){
+    unordered_map<string, unsigned short>::iterator it = symbol_addresses.find(name);
+    if(it == symbol_addresses.end()) return false;
+    address = it->second;
+    return true;
+}
+
+bool Emulator::decode(unsigned short address, DecodedInstruction& instruction){
+    if(!executable[address]){ // decoded once per address, so the check costs nothing in the run loop
+        fail("Executing a section without the x flag at " + hex(address) + ".");
+        return false;
+    }
+    unsigned char descr = memory[address];
+    instruction.opcode = descr >> 3;
+    if(instruction.opcode > LAST_OPCODE){
+        fail("Illegal instruction " + hex(descr) + " at " + hex(address) + ".");
+        return false;
+    }
+    instruction.size = (descr & 0x4) ? 2 : 1;
+    instruction.cycles = 1 + STACK_CYCLES[instruction.opcode];
+    unsigned short next = address + 1;
+    for(int i = 0; i < OPERAND_COUNT[instruction.opcode]; i++){
+        DecodedOperand& operand = instruction.operands[i];
+        unsigned char descr = memory[next++];
+        operand.mode = descr >> 5;
+        operand.reg = (descr >> 1) & 0xF;
+        operand.high = descr & 0x1;
+        operand.value = 0;
+        if(operand.mode > 0x4){
+            fail("Illegal addressing mode at " + hex(address) + ".");
+            return false;
+        }
+        if(operand.mode >= 0x1 && operand.mode <= 0x3 && operand.reg > 7 && operand.reg != 0xF){
+            fail("Illegal register at " + hex(address) + ".");
+            return false;
+        }
+        if(operand.mode == 0x0){
+            operand.value = instruction.size == 1 ? memory[next] : read16(next);
+            next += instruction.size;
+        }
+        else if(operand.mode == 0x3 || operand.mode == 0x4){
+            operand.value = read16(next);
+            next += 2;
+        }
+        if(operand.mode >= 0x2) instruction.cycles++;
+    }
+    instruction.length = (unsigned short)(next - address);
+    instruction.end = next;
+    instruction.next = &decoded[next];
+    instruction.handler = instruction.opcode;
+    const DecodedOperand& a = instruction.operands[0];
+    const DecodedOperand& b = instruction.operands[1];
+    instruction.target = &decoded[a.value]; // only used by the FAST_IMMEDIATE jumps
+    if(instruction.opcode >= 0x05 && instruction.opcode <= 0x08 && a.mode == 0x0) instruction.handler |= FAST_IMMEDIATE;
+    bool register_destination = b.mode == 0x1 && b.reg < REG_PC;
+    if(instruction.opcode >= 0x0C && instruction.opcode <= 0x11 && instruction.opcode != 0x0F && instruction.opcode != 0x10
+        && instruction.size == 2 && register_destination && (a.mode == 0x0 || (a.mode == 0x1 && a.reg < REG_PC))) // run() doesn't keep r[REG_PC] for them
+        instruction.handler |= a.mode == 0x0 ? FAST_IMMEDIATE : FAST_REGISTER;
+    code_pages[address >> PAGE_BITS] = 1;
+    code_pages[(unsigned short)(next - 1) >> PAGE_BITS] = 1;
+    return true;
+}
+
+void Emulator::invalidate(unsigned short address){
+    // instructions are at most 7 bytes long
+    for(int i = 0; i < 7; i++) decoded[(unsigned short)(address - i)].length = 0;
+}
+
+int Emulator::immediateDestination(unsigned short at){
+    return fail("Immediate destination at " + hex(at) + ".");
+}
+
+__attribute__((always_inline)) inline int Emulator::execute(const DecodedInstruction& instruction, unsigned short at){
+    // r[REG_PC] already holds the address of the next instruction, writes to %r7 (mov $x, %r7 / pop %r7) land there too
+    const DecodedOperand& a = instruction.operands[0];
+    const DecodedOperand& b = instruction.operands[1];
+    int size = instruction.size;
+    int status = EMULATOR_LIMIT;
+    switch(instruction.handler){
+        case 0x00: // halt
+            status = EMULATOR_HALTED;
+            break;
+        case 0x01: // iret
+            r[REG_PSW] = pop();
+            r[REG_PC] = pop();
+            break;
+        case 0x02: // ret
+            r[REG_PC] = pop();
+            break;
+        case 0x03: // int
+        {
+            unsigned short entry = (read(a, 2) % 8) * 2;
+            push(r[REG_PC]);
+            push(r[REG_PSW]);
+            r[REG_PC] = read16(entry);
+            break;
+        }
+        case 0x04: // call
+        {
+            unsigned short target = read(a, 2);
+            push(r[REG_PC]);
+            r[REG_PC] = target;
+            break;
+        }
+        case 0x05: // jmp
+            r[REG_PC] = read(a, 2);
+            break;
+        case 0x06: // jeq
+            if(r[REG_PSW] & PSW_Z) r[REG_PC] = read(a, 2);
+            break;
+        case 0x07: // jne
+            if(!(r[REG_PSW] & PSW_Z)) r[REG_PC] = read(a, 2);
+            break;
+        case 0x08: // jgt, signed greater
+            if(!(r[REG_PSW] & PSW_Z) && !(r[REG_PSW] & PSW_N) == !(r[REG_PSW] & PSW_O)) r[REG_PC] = read(a, 2);
+            break;
+        case 0x09: // push
+            push(read(a, size));
+            break;
+        case 0x0A: // pop
+            if(!write(a, size, pop())) status = immediateDestination(at);
+            break;
+        case 0x0B: // xchg
+        {
+            unsigned short src = read(a, size), dst = read(b, size);
+            if(!write(b, size, src) || !write(a, size, dst)) status = immediateDestination(at);
+            break;
+        }
+        case 0x0C: // mov
+        {
+            unsigned short src = read(a, size);
+            if(!write(b, size, src)) status = immediateDestination(at);
+            setFlags(src, size, PSW_Z | PSW_N);
+            break;
+        }
+        case 0x0D: // add
+        {
+            unsigned int src = read(a, size), dst = read(b, size), result = dst + src;
+            unsigned int sign = size == 2 ? 0x8000 : 0x80;
+            if(!write(b, size, result)) status = immediateDestination(at);
+            setFlags(result, size, PSW_Z | PSW_N | PSW_O | PSW_C);
+            if(~(dst ^ src) & (dst ^ result) & sign) r[REG_PSW] |= PSW_O;
+            if((result >> (size * 8)) & 1) r[REG_PSW] |= PSW_C;
+            break;
+        }
+        case 0x0E: // sub
+        case 0x11: // cmp
+        {
+            unsigned int src = read(a, size), dst = read(b, size), result = dst - src;
+            unsigned int sign = size == 2 ? 0x8000 : 0x80;
+            if(instruction.opcode == 0x0E && !write(b, size, result)) status = immediateDestination(at);
+            setFlags(result, size, PSW_Z | PSW_N | PSW_O | PSW_C);
+            if((dst ^ src) & (dst ^ result) & sign) r[REG_PSW] |= PSW_O;
+            if(dst < src) r[REG_PSW] |= PSW_C; // borrow
+            break;
+        }
+        case 0x0F: // mul
+        case 0x10: // div
+        {
+            int src = (short)read(a, size), dst = (short)read(b, size);
+            if(size == 1){ // sign extend bytes
+                src = (signed char)src;
+                dst = (signed char)dst;
+            }
+            if(instruction.opcode == 0x10 && src == 0){
+                status = fail("Division by zero at " + hex(at) + ".");
+                break;
+            }
+            unsigned short result = instruction.opcode == 0x0F ? dst * src : dst / src;
+            if(!write(b, size, result)) status = immediateDestination(at);
+            setFlags(result, size, PSW_Z | PSW_N);
+            break;
+        }
+        case 0x12: // not
+        case 0x13: // and
+        case 0x14: // or
+        case 0x15: // xor
+        case 0x16: // test
+        {
+            unsigned short src = read(a, size), dst = read(b, size), result;
+            switch(instruction.opcode){
+                case 0x12: result = ~src; break;
+                case 0x13: case 0x16: result = dst & src; break;
+                case 0x14: result = dst | src; break;
+                default: result = dst ^ src;
+            }
+            if(instruction.opcode != 0x16 && !write(b, size, result)) status = immediateDestination(at);
+            setFlags(result, size, PSW_Z | PSW_N);
+            break;
+        }
+        case 0x17: // shl src, dst
+        case 0x18: // shr dst, src
+        {
+            unsigned int bits = size * 8;
+            const DecodedOperand& dst_operand = instruction.opcode == 0x17 ? b : a;
+            unsigned int count = read(instruction.opcode == 0x17 ? a : b, size);
+            unsigned int dst = read(dst_operand, size);
+            unsigned int result = 0;
+            bool carry = false;
+            if(instruction.opcode == 0x17){
+                if(count < bits) result = dst << count;
+                if(count >= 1 && count <= bits) carry = (dst >> (bits - count)) & 1;
+            }else{
+                if(count < bits) result = dst >> count;
+                if(count >= 1 && count <= bits) carry = (dst >> (count - 1)) & 1;
+            }
+            if(!write(dst_operand, size, result)) status = immediateDestination(at);
+            setFlags(result, size, PSW_Z | PSW_N | PSW_C);
+            if(carry) r[REG_PSW] |= PSW_C;
+            break;
+        }
+    }
+    return status;
+}
+
+int Emulator::run(unsigned long long max_instructions){
+    // pc and counters live in locals, r[REG_PC] is only brought up to date for the instructions execute() handles
+    unsigned short psw = r[REG_PSW];
+    unsigned long long executed = instructions;
+    unsigned long long extra = cycles - instructions; // cycles beyond one per instruction, only execute()'s instructions take them
+    unsigned long long limit = max_instructions == 0 ? ~0ULL : instructions + max_instructions;
+    int status = EMULATOR_LIMIT;
+    DecodedInstruction* cache = decoded.data();
+    DecodedInstruction* current = &cache[r[REG_PC]];
+    while(executed < limit){
+        DecodedInstruction& instruction = *current;
+        if(__builtin_expect(instruction.length == 0, 0) && !decode(current - cache, instruction)){
+            status = EMULATOR_FAULT;
+            break;
+        }
+        DecodedInstruction* next = instruction.next;
+        executed++;
+        const DecodedOperand& a = instruction.operands[0];
+        const DecodedOperand& b = instruction.operands[1];
+        switch(instruction.handler){
+        // word sized forms with register destinations skip operand mode dispatch
+        case 0x05 | FAST_IMMEDIATE: // jmp
+            next = instruction.target;
+            break;
+        case 0x06 | FAST_IMMEDIATE: // jeq
+            if(psw & PSW_Z) next = instruction.target;
+            break;
+        case 0x07 | FAST_IMMEDIATE: // jne
+            if(!(psw & PSW_Z)) next = instruction.target;
+            break;
+        case 0x08 | FAST_IMMEDIATE: // jgt
+            if(!(psw & PSW_Z) && !(psw & PSW_N) == !(psw & PSW_O)) next = instruction.target;
+            break;
+        case 0x0C | FAST_IMMEDIATE: // mov
+        case 0x0C | FAST_REGISTER:
+        {
+            unsigned short src = instruction.handler & FAST_IMMEDIATE ? a.value : r[a.reg];
+            r[b.reg] = src;
+            psw = (psw & ~(PSW_Z | PSW_N)) | (src == 0 ? PSW_Z : 0) | (src & 0x8000 ? PSW_N : 0);
+            break;
+        }
+        case 0x0D | FAST_IMMEDIATE: // add
+        case 0x0D | FAST_REGISTER:
+        {
+            unsigned int src = instruction.handler & FAST_IMMEDIATE ? a.value : r[a.reg];
+            unsigned int dst = r[b.reg], result = dst + src;
+            r[b.reg] = result;
+            psw = (psw & ~(PSW_Z | PSW_N | PSW_O | PSW_C)) | ((result & 0xFFFF) == 0 ? PSW_Z : 0) | (result & 0x8000 ? PSW_N : 0)
+                | (~(dst ^ src) & (dst ^ result) & 0x8000 ? PSW_O : 0) | (result & 0x10000 ? PSW_C : 0);
+            break;
+        }
+        case 0x0E | FAST_IMMEDIATE: // sub
+        case 0x0E | FAST_REGISTER:
+        case 0x11 | FAST_IMMEDIATE: // cmp
+        case 0x11 | FAST_REGISTER:
+        {
+            unsigned int src = instruction.handler & FAST_IMMEDIATE ? a.value : r[a.reg];
+            unsigned int dst = r[b.reg], result = dst - src;
+            if(instruction.opcode == 0x0E) r[b.reg] = result;
+            psw = (psw & ~(PSW_Z | PSW_N | PSW_O | PSW_C)) | ((result & 0xFFFF) == 0 ? PSW_Z : 0) | (result & 0x8000 ? PSW_N : 0)
+                | ((dst ^ src) & (dst ^ result) & 0x8000 ? PSW_O : 0) | (dst < src ? PSW_C : 0);
+            break;
+        }
+        default:
+            // operands see pc of the next instruction, that is what PC relative offsets are computed against
+            r[REG_PC] = instruction.end;
+            r[REG_PSW] = psw;
+            extra += instruction.cycles - 1;
+            status = execute(instruction, instruction.end - instruction.length);
+            next = &cache[r[REG_PC]];
+            psw = r[REG_PSW];
+            if(status != EMULATOR_LIMIT) limit = 0;
+        }
+        current = next;
+    }
+    r[REG_PC] = current - cache;
+    r[REG_PSW] = psw;
+    instructions = executed;
+    cycles = executed + extra;
+    return status;
+}
+
+string Emulator::registersToString(){
+    stringstream ss;
+    for(int i = 0; i < 8; i++) ss<<"r"<<i<<"="<<hex(r[i])<<" ";
+    ss<<"psw="<<hex(r[REG_PSW]);
+    return ss.str();
+}
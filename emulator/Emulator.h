@@ -0,0 +1,153 @@
+#ifndef EMULATOR_H
+#define EMULATOR_H
+
+#include "../INCLUDES.h"
+#include "../ObjectFile.h"
+#include <vector>
+#include <unordered_map>
+
+#define MEMORY_SIZE 0x10000
+#define REG_SP 6 // register numbers as encoded by the assembler
+#define REG_PC 7
+#define REG_PSW 0xF
+#define PSW_Z 0x1
+#define PSW_O 0x2
+#define PSW_C 0x4
+#define PSW_N 0x8
+#define PAGE_BITS 8 // granularity of code tracking for self modifying code
+#define FAST_IMMEDIATE 0x20 // handler flags: word sized, immediate source or jump target
+#define FAST_REGISTER 0x40 // word sized, register source and register destination
+
+enum EmulatorStatus{
+    EMULATOR_HALTED,
+    EMULATOR_LIMIT, // instruction limit reached before halt
+    EMULATOR_FAULT // illegal instruction, addressing mode or division by zero, see error
+};
+
+struct DecodedOperand{
+    unsigned char mode; // addressing mode, 0x0 - 0x4
+    unsigned char reg; // 0xA when no register is used
+    unsigned char high; // L/H bit for byte sized register direct operands
+    unsigned short value; // immediate, offset or address
+};
+
+struct DecodedInstruction{
+    unsigned char length; // bytes, 0 while not decoded
+    unsigned char opcode;
+    unsigned char handler; // opcode, or opcode | FAST_* for the common forms run() special cases
+    unsigned char size; // operand size in bytes, 1 or 2
+    unsigned char cycles;
+    unsigned short end; // address of the following instruction, what %r7 reads while this one runs
+    DecodedOperand operands[2];
+    DecodedInstruction* next; // entry of the instruction that follows, run() steps through these instead of computing pc
+    DecodedInstruction* target; // entry of the destination of an immediate jump
+};
+
+/*
+    Interpreter for the processor from the README. Instructions are decoded once
+    per address into a cache indexed by pc, so the run loop only dispatches on
+    pre-decoded opcodes and operands. Entries point at the entry of the next
+    instruction and of an immediate jump destination, the loop follows those
+    and only goes back to pc for the forms execute() handles. Writes into
+    memory that holds decoded instructions drop the affected cache entries.
+
+    Cycle model: one cycle per instruction plus one per data memory access
+    (memory operands and stack traffic), instruction fetch is free.
+*/
+class Emulator{
+    private:
+        vector<DecodedInstruction> decoded; // one entry per address
+        vector<unsigned char> code_pages; // pages with cached instructions
+        vector<unsigned char> executable; // one entry per address, 0 inside sections loaded without the x flag
+        unordered_map<string, unsigned short> section_addresses;
+        unordered_map<string, unsigned short> symbol_addresses;
+
+        bool decode(unsigned short address, DecodedInstruction& instruction);
+        void invalidate(unsigned short address); // drops cached instructions overlapping address
+
+        int fail(string message); // sets error, returns EMULATOR_FAULT
+        int immediateDestination(unsigned short at); // kept out of line so run() stays small
+        int execute(const DecodedInstruction& instruction, unsigned short at); // every form run() doesn't special case, EMULATOR_LIMIT to go on
+
+        inline unsigned short read16(unsigned short address){
+            return memory[address] | (memory[(unsigned short)(address+1)] << 8);
+        }
+        inline void write8(unsigned short address, unsigned char value){
+            memory[address] = value;
+            if(code_pages[address >> PAGE_BITS]) invalidate(address);
+        }
+        inline void write16(unsigned short address, unsigned short value){
+            write8(address, value & 0xFF);
+            write8(address+1, value >> 8); // little endian
+        }
+        // operand access is inlined into run(), the hot loop does little else
+        inline unsigned short address(const DecodedOperand& operand){
+            switch(operand.mode){
+                case 0x2: return r[operand.reg];
+                case 0x3: return r[operand.reg] + operand.value;
+                default: return operand.value;
+            }
+        }
+        inline __attribute__((always_inline)) unsigned short read(const DecodedOperand& operand, int size){
+            switch(operand.mode){
+                case 0x0:
+                    return operand.value;
+                case 0x1:
+                    if(size == 2) return r[operand.reg];
+                    return operand.high ? r[operand.reg] >> 8 : r[operand.reg] & 0xFF;
+                default:
+                    unsigned short at = address(operand);
+                    return size == 2 ? read16(at) : memory[at];
+            }
+        }
+        inline __attribute__((always_inline)) bool write(const DecodedOperand& operand, int size, unsigned short value){ // false for immediate destinations
+            switch(operand.mode){
+                case 0x0:
+                    return false;
+                case 0x1:
+                {
+                    unsigned short& target = r[operand.reg];
+                    if(size == 2) target = value;
+                    else if(operand.high) target = (target & 0x00FF) | (value << 8);
+                    else target = (target & 0xFF00) | (value & 0xFF);
+                    return true;
+                }
+                default:
+                    if(size == 2) write16(address(operand), value);
+                    else write8(address(operand), value & 0xFF);
+                    return true;
+            }
+        }
+        inline void push(unsigned short value){
+            r[REG_SP] -= 2;
+            write16(r[REG_SP], value);
+        }
+        inline unsigned short pop(){
+            unsigned short value = read16(r[REG_SP]);
+            r[REG_SP] += 2;
+            return value;
+        }
+        inline void setFlags(unsigned short result, int size, unsigned short mask){ // Z and N from result, others cleared in mask
+            unsigned short sign = size == 2 ? 0x8000 : 0x80;
+            unsigned short all = size == 2 ? 0xFFFF : 0xFF;
+            r[REG_PSW] &= ~mask;
+            if((result & all) == 0) r[REG_PSW] |= PSW_Z;
+            if(result & sign) r[REG_PSW] |= PSW_N;
+        }
+    public:
+        unsigned short r[16]; // r0 - r7 and psw at REG_PSW, so operands index it like the encoding does
+        unsigned char memory[MEMORY_SIZE];
+        unsigned long long instructions;
+        unsigned long long cycles;
+        string error; // reason of the last EMULATOR_FAULT or failed load
+
+        Emulator();
+
+        bool load(ObjectFile& object, unsigned short base=0); // places sections one after another from base, clears nobits sections and applies relocations
+        void reset(); // registers, counters and decode cache, memory is kept
+        int run(unsigned long long max_instructions=0); // runs until halt, 0 means no limit, returns EmulatorStatus
+        bool symbolAddress(string name, unsigned short& address); // after load
+        string registersToString();
+};
+
+#endif
@@ -0,0 +1,61 @@
+#include "Emulator.h"
+#include <chrono>
+
+/*
+    emulator [--entry=<symbol>] [--base=<address>] [--limit=<instructions>] <object_file>
+
+    Loads an object written by the assembler, runs it from the entry symbol (or
+    from the first section) until halt and prints the counters and registers.
+*/
+int main(int argc, char *argv[]){
+    string input = "";
+    string entry = "";
+    unsigned short base = 0;
+    unsigned long long limit = 0;
+    for(int i = 1; i < argc; i++){
+        string arg = argv[i];
+        if(arg.find("--entry=") == 0) entry = arg.substr(8);
+        else if(arg.find("--base=") == 0) base = stoi(arg.substr(7), 0, 0);
+        else if(arg.find("--limit=") == 0) limit = stoull(arg.substr(8));
+        else if(arg.find("--") == 0) {
+            cout << "ERROR: Unknown option " << arg << endl;
+            return -1;
+        }
+        else if(input == "") input = arg;
+        else {
+            cout << "ERROR: Only one object file can be run." << endl;
+            return -1;
+        }
+    }
+    if(input == ""){
+        cout << "Usage: emulator [--entry=<symbol>] [--base=<address>] [--limit=<instructions>] <object_file>" << endl;
+        return -1;
+    }
+
+    ObjectFile object;
+    if(!object.read(input)){
+        cout << object.error << endl;
+        return -1;
+    }
+    Emulator* emulator = new Emulator();
+    if(!emulator->load(object, base)){
+        cout << emulator->error << endl;
+        return -1;
+    }
+    if(entry != "" && !emulator->symbolAddress(entry, emulator->r[REG_PC])){
+        cout << "Entry symbol " << entry << " is not defined." << endl;
+        return -1;
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    int status = emulator->run(limit);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    if(status == EMULATOR_HALTED) cout << "Halted";
+    else if(status == EMULATOR_LIMIT) cout << "Stopped at the instruction limit";
+    else cout << "Fault: " << emulator->error << endl << "Stopped";
+    cout << " after " << emulator->instructions << " instructions, " << emulator->cycles << " cycles";
+    if(seconds > 0) cout << " (" << (long long)(emulator->instructions / seconds / 1e6) << " MIPS)";
+    cout << endl << emulator->registersToString() << endl;
+    return status == EMULATOR_HALTED ? 0 : 1;
+}
@@ -0,0 +1,449 @@
+#include "Linker.h"
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <set>
+
+// runs job(0) ... job(count-1) on all cores, the calling thread is a worker too
+static void parallelFor(size_t count, function<void(size_t)> job){
+    atomic<size_t> next(0);
+    auto worker = [&](){
+        for(size_t i = next++; i < count; i = next++) job(i);
+    };
+    size_t worker_count = thread::hardware_concurrency();
+    if(worker_count > count) worker_count = count;
+    vector<thread> workers = {};
+    for(size_t i = 1; i < worker_count; i++) workers.push_back(thread(worker));
+    worker();
+    for(thread& t: workers) t.join();
+}
+
+static unsigned short read16(vector<char>& code, unsigned int at){
+    return (unsigned char)code[at] | ((unsigned char)code[at+1] << 8);
+}
+
+static void write16(vector<char>& code, unsigned int at, unsigned short value){
+    code[at] = value & 0xFF;
+    code[at+1] = value >> 8; // little endian
+}
+
+// R_386_8 fields (.byte) are a single byte, the others two
+static unsigned short readField(vector<char>& code, unsigned int at, bool byte){
+    return byte ? (unsigned char)code[at] : read16(code, at);
+}
+
+static void writeField(vector<char>& code, unsigned int at, unsigned short value, bool byte){
+    if(byte) code[at] = value & 0xFF;
+    else write16(code, at, value);
+}
+
+static string hex(unsigned int value, int width){
+    stringstream ss;
+    ss<<setw(width)<<setfill('0')<<std::hex<<value;
+    return ss.str();
+}
+
+Linker::Linker(){
+    output_st = new SymbolTable();
+    image = false;
+    gc_sections = false;
+    removed_sections = 0;
+    removed_bytes = 0;
+}
+
+Linker::~Linker(){
+    for(LinkedObject* object: objects){
+        for(pair<const string, InputSection*>& piece: object->pieces) delete piece.second;
+        delete object->object;
+        delete object;
+    }
+    for(OutputSection* output: output_sections){
+        delete output->section;
+        delete output;
+    }
+    for(Archive* archive: archives) delete archive;
+    delete output_st;
+}
+
+bool Linker::fail(string message){
+    error = message;
+    return false;
+}
+
+void Linker::addObject(string file_name){
+    objects.push_back(new LinkedObject(file_name));
+}
+
+bool Linker::addArchive(string file_name){
+    Archive* archive = new Archive();
+    if(!archive->open(file_name)){
+        error = archive->error;
+        delete archive;
+        return false;
+    }
+    archives.push_back(archive);
+    archive_names.push_back(file_name);
+    return true;
+}
+
+void Linker::place(string section, unsigned int address){
+    placements[section] = address;
+}
+
+void Linker::addEntry(string symbol){
+    entries.push_back(symbol);
+}
+
+void Linker::setGcSections(bool enable){
+    gc_sections = enable;
+}
+
+bool Linker::readObjects(){
+    // parsing dominates when there are thousands of small inputs
+    parallelFor(objects.size(), [&](size_t i){
+        objects[i]->object->read(objects[i]->file_name);
+    });
+    for(LinkedObject* object: objects){
+        if(object->object->error != "") return fail(object->file_name + ": " + object->object->error);
+    }
+    return true;
+}
+
+bool Linker::loadArchiveMembers(){
+    if(archives.size() == 0) return true;
+    unordered_set<string> defined = {};
+    vector<string> missing = {}; // externs in load order
+    auto scan = [&](LinkedObject* object){
+        for(SymbolTableEntry& ste: object->object->st->table){
+            if(ste.local) continue;
+            if(ste.section != "UND") defined.insert(ste.name);
+            else missing.push_back(ste.name);
+        }
+    };
+    for(LinkedObject* object: objects) scan(object);
+    set<pair<size_t, int>> loaded = {};
+    // every wave pulls in the members for the symbols found missing so far and parses them in parallel
+    for(size_t next = 0; next < missing.size();){
+        vector<LinkedObject*> wave = {};
+        vector<pair<size_t, int>> sources = {};
+        for(; next < missing.size(); next++){
+            if(defined.find(missing[next]) != defined.end()) continue;
+            for(size_t i = 0; i < archives.size(); i++){
+                int member = archives[i]->findSymbol(missing[next]);
+                if(member < 0) continue;
+                if(loaded.insert(make_pair(i, member)).second){
+                    wave.push_back(new LinkedObject(archive_names[i] + "(" + archives[i]->memberName(member) + ")"));
+                    sources.push_back(make_pair(i, member));
+                }
+                break;
+            }
+        }
+        objects.insert(objects.end(), wave.begin(), wave.end());
+        parallelFor(wave.size(), [&](size_t i){
+            size_t length;
+            const char* data = archives[sources[i].first]->memberData(sources[i].second, length);
+            wave[i]->object->readBuffer(data, length);
+        });
+        for(LinkedObject* object: wave){
+            if(object->object->error != "") return fail(object->file_name + ": " + object->object->error);
+            scan(object);
+        }
+    }
+    return true;
+}
+
+bool Linker::mergeSections(){
+    for(LinkedObject* object: objects){
+        for(Section* section: object->object->sections){
+            unordered_map<string, OutputSection*>::iterator it = output_index.find(section->name);
+            OutputSection* output;
+            if(it == output_index.end()){
+                output = new OutputSection(section->name);
+                output->section->flags = section->flags;
+                output_sections.push_back(output);
+                output_index.emplace(section->name, output);
+            }else output = it->second;
+            if(section->flags != output->section->flags){
+                return fail("Section " + section->name + " has other flags in " + object->file_name + " than in " + output->pieces[0]->object->file_name + ".");
+            }
+            // location_counter tracks the merged size, code is copied while relocating
+            InputSection* piece = new InputSection(object, section, output, output->section->location_counter);
+            output->pieces.push_back(piece);
+            object->pieces.emplace(section->name, piece);
+            output->section->location_counter += section->location_counter;
+            if(output->section->location_counter > ADDRESS_SPACE) return fail("Section " + section->name + " doesn't fit into the address space.");
+        }
+    }
+    return true;
+}
+
+bool Linker::resolveSymbols(){
+    for(LinkedObject* object: objects){
+        for(SymbolTableEntry& ste: object->object->st->table){
+            if(ste.local || ste.section == "UND") continue;
+            if(ste.section != "ABS" && object->pieces.find(ste.section) == object->pieces.end()){
+                return fail(object->file_name + ": Symbol " + ste.name + " is defined in unknown section " + ste.section + ".");
+            }
+            pair<unordered_map<string, GlobalSymbol>::iterator, bool> inserted = globals.emplace(ste.name, GlobalSymbol(object, &ste));
+            if(inserted.second == false){
+                return fail("Symbol " + ste.name + " is defined in " + inserted.first->second.object->file_name + " and in " + object->file_name + ".");
+            }
+        }
+    }
+    return true;
+}
+
+bool Linker::collectGarbage(){
+    vector<InputSection*> work = {};
+    auto mark = [&](InputSection* piece){
+        if(piece->live) return;
+        piece->live = true;
+        work.push_back(piece);
+    };
+    auto markGlobal = [&](GlobalSymbol& global){
+        if(global.ste->section != "ABS") mark(global.object->pieces[global.ste->section]);
+    };
+    if(entries.size() == 0){
+        for(pair<const string, GlobalSymbol>& global: globals) markGlobal(global.second);
+        if(objects.size() > 0 && objects[0]->object->sections.size() > 0) mark(objects[0]->pieces[objects[0]->object->sections[0]->name]);
+    }
+    for(string& entry: entries){
+        unordered_map<string, GlobalSymbol>::iterator it = globals.find(entry);
+        if(it == globals.end()) return fail("Entry symbol " + entry + " is not defined.");
+        markGlobal(it->second);
+    }
+    // a section with a fixed address is there for the hardware, e.g. the interrupt vector table
+    for(pair<const string, unsigned int>& placement: placements){
+        unordered_map<string, OutputSection*>::iterator it = output_index.find(placement.first);
+        if(it == output_index.end()) continue;
+        for(InputSection* piece: it->second->pieces) mark(piece);
+    }
+    while(work.size() > 0){
+        InputSection* piece = work.back();
+        work.pop_back();
+        for(RelocationTableEntry& rte: piece->section->relocation_table){
+            SymbolTableEntry* ste = piece->object->object->findSymbolById(rte.value);
+            if(ste->section == "ABS") continue;
+            if(ste->section != "UND"){
+                mark(piece->object->pieces[ste->section]);
+                continue;
+            }
+            unordered_map<string, GlobalSymbol>::iterator it = ste->local ? globals.end() : globals.find(ste->name);
+            if(it != globals.end()) markGlobal(it->second);
+            else used_externs.insert(ste->name);
+        }
+    }
+    // dead pieces go, the live ones move up to close the gaps
+    vector<OutputSection*> kept = {};
+    for(OutputSection* output: output_sections){
+        vector<InputSection*> live = {};
+        unsigned int size = 0;
+        for(InputSection* piece: output->pieces){
+            if(piece->live){
+                piece->offset = size;
+                size += piece->section->location_counter;
+                live.push_back(piece);
+                continue;
+            }
+            removed_sections++;
+            removed_bytes += piece->section->location_counter;
+            piece->object->pieces.erase(piece->section->name);
+            delete piece;
+        }
+        output->pieces = live;
+        output->section->location_counter = size;
+        if(live.size() > 0){
+            kept.push_back(output);
+            continue;
+        }
+        output_index.erase(output->section->name);
+        delete output->section;
+        delete output;
+    }
+    output_sections = kept;
+    return true;
+}
+
+bool Linker::placeSections(){
+    for(pair<const string, unsigned int>& placement: placements){
+        unordered_map<string, OutputSection*>::iterator it = output_index.find(placement.first);
+        if(it == output_index.end()) return fail("Section " + placement.first + " given with --place is not in any input.");
+        it->second->address = placement.second;
+        it->second->placed = true;
+    }
+    // the rest follows the placed sections in order of appearance
+    unsigned int next = 0;
+    for(OutputSection* output: output_sections){
+        if(output->placed) next = max(next, output->address + output->section->location_counter);
+    }
+    for(OutputSection* output: output_sections){
+        if(output->placed) continue;
+        output->address = next;
+        next += output->section->location_counter;
+    }
+    vector<OutputSection*> by_address = output_sections;
+    sort(by_address.begin(), by_address.end(), [](OutputSection* a, OutputSection* b){ return a->address < b->address; });
+    for(size_t i = 0; i < by_address.size(); i++){
+        unsigned int end = by_address[i]->address + by_address[i]->section->location_counter;
+        if(end > ADDRESS_SPACE) return fail("Section " + by_address[i]->section->name + " doesn't fit into the address space.");
+        if(i + 1 < by_address.size() && end > by_address[i+1]->address){
+            return fail("Sections " + by_address[i]->section->name + " and " + by_address[i+1]->section->name + " overlap.");
+        }
+    }
+    return true;
+}
+
+void Linker::buildSymbolTable(){
+    // same leading entries as the assembler writes
+    vector<SymbolTableEntry> entries = {
+        SymbolTableEntry("", "UND", 0, true, false),
+        SymbolTableEntry("ABS", "ABS", 0, true, true)
+    };
+    for(OutputSection* output: output_sections){
+        output->symbol_id = entries.size();
+        entries.push_back(SymbolTableEntry(output->section->name, output->section->name, 0, true, true));
+    }
+    // local symbols are dropped, relocations only refer to section symbols, globals and externs
+    for(LinkedObject* object: objects){
+        for(SymbolTableEntry& ste: object->object->st->table){
+            if(ste.local) continue;
+            if(ste.section != "UND"){
+                // defined in a section --gc-sections dropped
+                if(ste.section != "ABS" && object->pieces.find(ste.section) == object->pieces.end()) continue;
+                short int offset = ste.offset;
+                string section = ste.section;
+                if(section != "ABS") offset += object->pieces[section]->offset;
+                entries.push_back(SymbolTableEntry(ste.name, section, offset, false, true));
+            }else if(globals.find(ste.name) == globals.end() && extern_ids.find(ste.name) == extern_ids.end()
+                    && (!gc_sections || used_externs.find(ste.name) != used_externs.end())){
+                extern_ids.emplace(ste.name, entries.size());
+                entries.push_back(SymbolTableEntry(ste.name, "UND", 0, false, false, true));
+            }
+        }
+    }
+    for(size_t i = 0; i < entries.size(); i++){
+        entries[i].id = i;
+        output_st->addSymbol(entries[i]);
+    }
+}
+
+bool Linker::target(LinkedObject* object, SymbolTableEntry* ste, OutputSection*& section, unsigned int& offset){
+    if(ste->section == "UND"){
+        unordered_map<string, GlobalSymbol>::iterator it = globals.find(ste->name);
+        if(ste->local || it == globals.end()) return false;
+        object = it->second.object;
+        ste = it->second.ste;
+    }
+    if(ste->section == "ABS"){
+        section = nullptr;
+        offset = (unsigned short)ste->offset;
+        return true;
+    }
+    InputSection* piece = object->pieces[ste->section];
+    section = piece->output;
+    offset = piece->offset + (unsigned short)ste->offset;
+    return true;
+}
+
+void Linker::relocateSection(OutputSection* output){
+    if(output->section->nobits()) return; // only a size, nothing to copy or patch
+    vector<char>& code = output->section->machine_code;
+    code.resize(output->section->location_counter);
+    // hex is decoded here, on the worker that owns the section
+    for(InputSection* piece: output->pieces){
+        if(!piece->object->object->decodeSection(piece->section)){
+            output->error = piece->object->file_name + ": Invalid hex digit in machine code of section " + output->section->name + ".";
+            return;
+        }
+        copy(piece->section->machine_code.begin(), piece->section->machine_code.end(), code.begin() + piece->offset);
+    }
+    // field holds the addend: R_386_16 and R_386_8 add the symbol address, R_386_PC16 the distance from the field to it
+    for(InputSection* piece: output->pieces){
+        for(RelocationTableEntry& rte: piece->section->relocation_table){
+            SymbolTableEntry* ste = piece->object->object->findSymbolById(rte.value);
+            bool byte = rte.type == "R_386_8";
+            if(rte.offset < 0 || rte.offset + (byte ? 1 : 2) > (int)piece->section->machine_code.size()){
+                output->error = piece->object->file_name + ": Relocation outside of section " + output->section->name + ".";
+                return;
+            }
+            bool pcrel = rte.type == "R_386_PC16";
+            unsigned int place = piece->offset + rte.offset;
+            OutputSection* section;
+            unsigned int offset;
+            bool resolved = target(piece->object, ste, section, offset);
+            unsigned short field = readField(code, place, byte);
+            if(image){
+                if(!resolved){
+                    output->error = piece->object->file_name + ": Unresolved symbol " + ste->name + ".";
+                    return;
+                }
+                unsigned int symbol = (section == nullptr ? 0 : section->address) + offset;
+                writeField(code, place, field + symbol - (pcrel ? output->address + place : 0), byte);
+                continue;
+            }
+            if(!resolved){ // stays a reference to the extern
+                output->section->relocation_table.push_back(RelocationTableEntry(place, extern_ids[ste->name], rte.type, ste->name));
+                continue;
+            }
+            writeField(code, place, field + offset - (pcrel && section == output ? place : 0), byte);
+            if(section == nullptr){
+                if(pcrel) output->section->relocation_table.push_back(RelocationTableEntry(place, output_st->findSymbol("ABS")->id, rte.type, "ABS"));
+            }else if(!pcrel || section != output){ // now relative to the start of the output section
+                output->section->relocation_table.push_back(RelocationTableEntry(place, section->symbol_id, rte.type, section->section->name));
+            }
+        }
+    }
+}
+
+bool Linker::link(bool placed_image){
+    image = placed_image;
+    if(objects.size() == 0 && archives.size() == 0) return fail("No input objects.");
+    if(!readObjects() || !loadArchiveMembers() || !mergeSections() || !resolveSymbols()) return false;
+    if(gc_sections && !collectGarbage()) return false;
+    if(image && !placeSections()) return false;
+    buildSymbolTable();
+    // every output section only patches its own bytes and appends to its own relocation table
+    parallelFor(output_sections.size(), [&](size_t i){
+        relocateSection(output_sections[i]);
+    });
+    for(OutputSection* output: output_sections){
+        if(output->error != "") return fail(output->error);
+    }
+    return true;
+}
+
+string Linker::objectToString(){
+    stringstream output;
+    for(OutputSection* section: output_sections){
+        output<<"#.ret"<<section->section->name<<endl;
+        output<<section->section->getRelocationTable()<<endl;
+    }
+    output<<output_st->toString();
+    output<<"MACHINE CODE:"<<endl;
+    for(OutputSection* section: output_sections){
+        output<<"#"<<section->section->name<<endl;
+        output<<section->section->getMachineCodeString()<<endl;
+    }
+    vector<Section*> sections = {};
+    for(OutputSection* section: output_sections) sections.push_back(section->section);
+    output<<Section::getSectionFlags(sections);
+    return output.str();
+}
+
+string Linker::imageToString(){
+    vector<OutputSection*> by_address = output_sections;
+    sort(by_address.begin(), by_address.end(), [](OutputSection* a, OutputSection* b){ return a->address < b->address; });
+    stringstream output;
+    for(OutputSection* section: by_address){
+        vector<char>& code = section->section->machine_code;
+        for(size_t i = 0; i < code.size(); i += 8){
+            output<<hex(section->address + i, 4)<<":";
+            for(size_t j = i; j < i + 8 && j < code.size(); j++) output<<" "<<hex((unsigned char)code[j], 2);
+            output<<endl;
+        }
+    }
+    return output.str();
+}
@@ -0,0 +1,116 @@
+#ifndef LINKER_H
+#define LINKER_H
+
+#include "../INCLUDES.h"
+#include "../ObjectFile.h"
+#include "../Archive.h"
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#define ADDRESS_SPACE 0x10000
+
+struct OutputSection;
+struct InputSection;
+
+struct LinkedObject{
+    string file_name;
+    ObjectFile* object;
+    unordered_map<string, InputSection*> pieces; // input section name -> placement
+
+    LinkedObject(string f):file_name(f), object(new ObjectFile()){}
+};
+
+struct InputSection{
+    LinkedObject* object;
+    Section* section;
+    OutputSection* output;
+    unsigned int offset; // position inside the output section
+    bool live; // reachable from a root, only used with --gc-sections
+
+    InputSection(LinkedObject* obj, Section* s, OutputSection* o, unsigned int off):object(obj), section(s), output(o), offset(off), live(false){}
+};
+
+struct OutputSection{
+    Section* section; // merged machine code and relocations that stay in the output
+    vector<InputSection*> pieces; // in link order
+    unsigned int address; // load address in a placed image
+    bool placed; // address given with --place
+    int symbol_id; // id of the section symbol in the output symbol table
+    string error; // first failure while relocating this section
+
+    OutputSection(string name):section(new Section(name)), address(0), placed(false), symbol_id(0){}
+};
+
+struct GlobalSymbol{
+    LinkedObject* object; // the one that defines the symbol
+    SymbolTableEntry* ste;
+
+    GlobalSymbol(LinkedObject* o, SymbolTableEntry* s):object(o), ste(s){}
+};
+
+/*
+    Links objects written by Assembler::end(). Sections with the same name are
+    concatenated in command line order, globals are resolved through one hash
+    index, archive members are pulled in only when they define a symbol that
+    is still missing, and relocations are applied on worker threads, one output section at
+    a time, since every section only patches its own bytes.
+
+    With --gc-sections only input sections reachable from the roots through
+    relocations are kept. The roots are the --entry symbols, or every global
+    and the first input section (where the emulator starts) when none is
+    given, and sections with a fixed address.
+
+    Sections with the same name have to agree on their flags. A nobits section
+    only adds up sizes: it keeps no bytes in a merged object and takes address
+    space but writes no lines in an image, the loader clears it.
+
+    The result is either a merged object in the assembler's format, with only
+    section symbols, globals and still undefined externs in the symbol table, or
+    a placed image in which every address is final.
+*/
+class Linker{
+    private:
+        vector<LinkedObject*> objects;
+        vector<Archive*> archives;
+        vector<string> archive_names;
+        vector<OutputSection*> output_sections; // in order of first appearance
+        unordered_map<string, OutputSection*> output_index;
+        unordered_map<string, GlobalSymbol> globals;
+        unordered_map<string, unsigned int> placements; // --place
+        SymbolTable* output_st;
+        unordered_map<string, int> extern_ids; // undefined externs in the merged object
+        vector<string> entries; // --entry
+        unordered_set<string> used_externs; // unresolved externs referenced by live sections
+        bool image;
+        bool gc_sections;
+
+        bool fail(string message); // sets error, always false
+        bool readObjects();
+        bool loadArchiveMembers(); // adds members that define symbols the objects so far are missing
+        bool mergeSections();
+        bool resolveSymbols();
+        bool collectGarbage(); // drops input sections no root reaches, closes the gaps they leave
+        bool placeSections();
+        void buildSymbolTable();
+        void relocateSection(OutputSection* output); // safe to run concurrently for different sections
+        bool target(LinkedObject* object, SymbolTableEntry* ste, OutputSection*& section, unsigned int& offset); // false for unresolved externs, section is null for ABS
+    public:
+        string error; // reason the last link failed
+        unsigned int removed_sections; // input sections dropped by --gc-sections
+        unsigned int removed_bytes;
+
+        Linker();
+        ~Linker();
+
+        void addObject(string file_name);
+        bool addArchive(string file_name); // false if it can't be opened, see error
+        void place(string section, unsigned int address); // fixed address of an output section in the image
+        void addEntry(string symbol); // root for --gc-sections
+        void setGcSections(bool enable);
+        bool link(bool placed_image); // false on errors, see error
+        string objectToString(); // merged object, after link(false)
+        string imageToString(); // "address: bytes" lines, after link(true)
+};
+
+#endif
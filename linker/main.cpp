@@ -0,0 +1,65 @@
+#include "Linker.h"
+#include "../FileManager.h"
+
+/*
+    linker [-o <output_file>] [--hex] [--place=<section>@<address>] [--gc-sections] [--entry=<symbol>] <object_file|archive>...
+
+    Without --hex the inputs are merged into one object in the assembler's
+    format, externs that none of the inputs defines stay undefined. With --hex
+    every symbol has to be resolved and the placed image is written as
+    "address: bytes" lines. Archive members are linked only when they define
+    a symbol that is still missing. --gc-sections drops the input sections that
+    no root reaches and reports what it saved on stderr.
+*/
+int main(int argc, char *argv[]){
+    Linker* linker = new Linker();
+    string output = "-";
+    bool image = false;
+    bool gc_sections = false;
+    int inputs = 0;
+    for(int i = 1; i < argc; i++){
+        string arg = argv[i];
+        if(arg == "-o" && i + 1 < argc) output = argv[++i];
+        else if(arg == "--hex") image = true;
+        else if(arg == "--gc-sections") gc_sections = true;
+        else if(arg.find("--entry=") == 0) linker->addEntry(arg.substr(8));
+        else if(arg.find("--place=") == 0){
+            size_t at = arg.find('@');
+            if(at == string::npos){
+                cout << "ERROR: Expected --place=<section>@<address>." << endl;
+                return -1;
+            }
+            linker->place(arg.substr(8, at - 8), stoi(arg.substr(at + 1), 0, 0));
+        }
+        else if(arg.find("--") == 0){
+            cout << "ERROR: Unknown option " << arg << endl;
+            return -1;
+        }
+        else if(Archive::isArchive(arg)){
+            if(!linker->addArchive(arg)){
+                cout << "ERROR: " << linker->error << endl;
+                return 1;
+            }
+            inputs++;
+        }
+        else {
+            linker->addObject(arg);
+            inputs++;
+        }
+    }
+    if(inputs == 0){
+        cout << "Usage: linker [-o <output_file>] [--hex] [--place=<section>@<address>] [--gc-sections] [--entry=<symbol>] <object_file|archive>..." << endl;
+        return -1;
+    }
+
+    linker->setGcSections(gc_sections);
+    if(!linker->link(image)){
+        cout << "ERROR: " << linker->error << endl;
+        return 1;
+    }
+    if(gc_sections) cerr << "Removed " << linker->removed_sections << " unused sections, " << linker->removed_bytes << " bytes." << endl;
+    FileManager fm;
+    fm.setContent(image ? linker->imageToString() : linker->objectToString(), output);
+    delete linker;
+    return 0;
+}
@@ -1,18 +1,312 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
 #include <iostream>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/inotify.h>
 
 #include "FileManager.h"
 #include "Assembler.h"
+#include "AssemblyCache.h"
+#include "Jobserver.h"
 
 using namespace std;
 
+static bool emit_prelude = false; // --emit-prelude, never cached
+static bool line_table = false; // -g
+
+static bool parseCount(string text, int& count){
+    if(text.empty() || !isdigit(text[0])) return false;
+    char* end;
+    errno = 0;
+    long value = strtol(text.c_str(), &end, 10);
+    if(*end != '\0' || errno == ERANGE || value > INT_MAX) return false;
+    count = value;
+    return true;
+}
+
+static string readWhole(string fname){
+    ifstream file(fname, ios::in | ios::binary);
+    if(file.is_open()==false) return "";
+    return string(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+}
+
+static int assembleTraced(string input, string output, AssemblyCache* cache, string stats_format, string prelude, Assembler** kept){
+    if(kept != nullptr) *kept = nullptr;
+    string key = "";
+    if(cache != nullptr){
+        TraceScope trace("cache lookup");
+        // the snapshot is part of the input, -g changes the output
+        key = cache->computeKey(input, (prelude == "" ? "" : "--prelude\n" + readWhole(prelude)) + (line_table ? "-g\n" : ""));
+        if(key != "" && cache->fetch(key, output)) return 0;
+    }
+    TraceScope trace("assemble");
+    Assembler* assembler = new Assembler(input, output);
+    Statistics* stats = stats_format == "" ? nullptr : new Statistics();
+    assembler->setStatistics(stats);
+    if(prelude != "") assembler->setPrelude(prelude);
+    if(emit_prelude) assembler->setEmitPrelude(true);
+    if(line_table) assembler->setLineTable(true);
+    int result = assembler->start();
+    if(cache != nullptr && key != "" && result == 0) cache->store(key, output);
+    if(kept != nullptr && result == 0) *kept = assembler;
+    if(stats != nullptr){
+        stats->finish();
+        cerr << (stats_format == "json" ? stats->toJSON() : stats->toString());
+    }
+    return result;
+}
+
+// kept gets the Assembler of a run that wrote the object, null after a cache hit or a failure
+static int assemble(string input, string output, AssemblyCache* cache, string stats_format, string trace_file, string prelude, Assembler** kept = nullptr){
+    if(trace_file != "") Tracer::active = new Tracer();
+    int result = assembleTraced(input, output, cache, stats_format, prelude, kept);
+    if(trace_file != "") Tracer::active->write(trace_file);
+    return result;
+}
+
+/*
+    Reassembles input every time it is written. The last assembled content is kept
+    in memory so saves that don't change anything are skipped. Every run happens in
+    a forked child because errors in the assembler abort the process.
+
+    The child starts with the Assembler of the last run that succeeded. Saves that
+    only rewrite instruction lines, into code of the same length that names symbols
+    already mentioned above the line, are patched into that object by
+    Assembler::patch(), every other save is assembled again from scratch. A child
+    that succeeds holds the newer state, so it goes on watching and the process it
+    was forked from exits. The process started from the shell only waits until the
+    last watching process is gone, and they stop when it does.
+*/
+static int watch(string input, string output, AssemblyCache* cache, string stats_format, string trace_file, string prelude){
+    size_t slash = input.find_last_of('/');
+    string dir = slash == string::npos ? "." : input.substr(0, slash+1);
+    string base = slash == string::npos ? input : input.substr(slash+1);
+    int fd = inotify_init1(0);
+    // editors often replace the file instead of writing into it, so the directory is watched
+    if(fd < 0 || inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0){
+        cerr<<"Directory "<<dir<<" cannot be watched"<<endl;
+        return -1;
+    }
+    int watching[2]; // every watching process holds the write end, EOF once the last one is gone
+    int lifeline[2]; // this process holds the write end, watching processes see it hang up when it's gone
+    if(pipe(watching) != 0 || pipe(lifeline) != 0){
+        cerr<<"Watch pipes cannot be created"<<endl;
+        return -1;
+    }
+    pid_t first_watcher = fork();
+    if(first_watcher != 0){
+        close(watching[1]);
+        close(lifeline[0]);
+        waitpid(first_watcher, nullptr, 0); // exits at the first handover, later watchers are not children of this process
+        char c;
+        while(read(watching[0], &c, 1) > 0);
+        return -1; // watching only ends when the input's directory can't be read
+    }
+    close(watching[0]);
+    close(lifeline[1]);
+
+    Assembler* assembler = nullptr; // state of the last run that succeeded
+    bool incremental = stats_format == "" && trace_file == "" && !emit_prelude; // statistics and traces are of full runs
+    string last_content = "";
+    bool first = true;
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while(true){
+        string content = readWhole(input);
+        if(first || content != last_content){
+            first = false;
+            last_content = content;
+            auto begin = chrono::steady_clock::now();
+            int succeeded[2];
+            if(pipe(succeeded) != 0){
+                cerr<<"Watch pipes cannot be created"<<endl;
+                return -1;
+            }
+            pid_t pid = fork();
+            if(pid == 0){
+                close(succeeded[0]);
+                bool patched = incremental && assembler != nullptr && assembler->patch();
+                if(!patched){
+                    delete assembler; // patch() may have changed part of it
+                    if(assemble(input, output, cache, stats_format, trace_file, prelude, &assembler) != 0) _exit(1);
+                }
+                long long ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - begin).count();
+                cout<<"Assembled "<<input<<" in "<<ms<<" ms"<<(patched ? ", edited lines only" : "")<<endl;
+                if(write(succeeded[1], "", 1) < 0){} // the parent exits either way, EOF tells it nothing new
+                close(succeeded[1]);
+            }else{
+                close(succeeded[1]);
+                char c;
+                bool taken_over = read(succeeded[0], &c, 1) == 1;
+                close(succeeded[0]);
+                if(taken_over) _exit(0);
+                waitpid(pid, nullptr, 0);
+                cout<<"Assembling "<<input<<" failed"<<endl;
+            }
+        }
+
+        bool changed = false;
+        while(!changed){
+            struct pollfd pfds[2] = {{fd, POLLIN, 0}, {lifeline[0], POLLIN, 0}};
+            if(poll(pfds, 2, -1) < 0 || pfds[1].revents != 0) _exit(0);
+            ssize_t n = read(fd, buffer, sizeof(buffer));
+            if(n <= 0) return -1;
+            for(char* p = buffer; p < buffer + n; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len){
+                struct inotify_event* event = (struct inotify_event*)p;
+                if(event->len > 0 && base == event->name) changed = true;
+            }
+        }
+        // swallow the burst of events a single save usually produces
+        struct pollfd pfd = {fd, POLLIN, 0};
+        while(poll(&pfd, 1, 50) > 0 && read(fd, buffer, sizeof(buffer)) > 0);
+    }
+}
+
+/*
+    Assembles input/output pairs in forked processes, like watch() errors only
+    end the child. The first child runs on this process's own job slot, every
+    further one needs a jobserver token, either from make or from a jobserver
+    created here with jobs slots. Children pass the same jobserver on to the
+    threads of Assembler::end().
+*/
+static int child_exits[2]; // self-pipe, written when a child exits so poll wakes up
+
+static void childExited(int){
+    char c = 0;
+    if(write(child_exits[1], &c, 1) < 0){} // full pipe already wakes poll
+}
+
+static int batch(vector<string>& files, int jobs, AssemblyCache* cache, string stats_format, string prelude){
+    if(Jobserver::active == nullptr) Jobserver::active = Jobserver::create(jobs);
+    if(Jobserver::active == nullptr || pipe2(child_exits, O_NONBLOCK | O_CLOEXEC) != 0){
+        cerr<<"Jobserver pipe cannot be created"<<endl;
+        return -1;
+    }
+    signal(SIGCHLD, childExited);
+    map<pid_t, size_t> running = {}; // child -> index of its input
+    vector<char> tokens = {}; // one for every running child after the first
+    size_t next = 0;
+    int failed = 0;
+    while(next < files.size() || running.size() > 0){
+        char token;
+        if(next < files.size() && (running.size() == 0 || Jobserver::active->tryAcquire(token))){
+            if(running.size() > 0) tokens.push_back(token);
+            pid_t pid = fork();
+            if(pid == 0) _exit(assemble(files[next], files[next+1], cache, stats_format, "", prelude) == 0 ? 0 : 1);
+            running[pid] = next;
+            next += 2;
+            continue;
+        }
+        int status = 0;
+        pid_t pid = waitpid(-1, &status, WNOHANG);
+        if(pid <= 0){
+            // nothing finished and no token free, wait for either
+            struct pollfd pfds[2] = {{child_exits[0], POLLIN, 0}, {Jobserver::active->descriptor(), POLLIN, 0}};
+            poll(pfds, next < files.size() ? 2 : 1, -1);
+            char buffer[64];
+            while(read(child_exits[0], buffer, sizeof(buffer)) > 0);
+            continue;
+        }
+        if(!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+            cerr<<"Assembling "<<files[running[pid]]<<" failed"<<endl;
+            failed++;
+        }
+        running.erase(pid);
+        if(tokens.size() > 0){
+            Jobserver::active->release(tokens.back());
+            tokens.pop_back();
+        }
+    }
+    return failed == 0 ? 0 : 1;
+}
+
 int main(int argc, char *argv[]){
-    if (argc != 3) {
-        std::cout << "ERROR: Number of given parameters must be 3.\n" << endl;
+    vector<string> files = {};
+    bool use_cache = false;
+    bool cache_stats = false;
+    bool watch_mode = false;
+    bool batch_mode = false;
+    int jobs = thread::hardware_concurrency();
+    string stats_format = ""; // empty, "text" or "json"
+    string trace_file = "";
+    string prelude = "";
+    string cache_dir = "";
+    unsigned long long cache_size = AssemblyCache::DEFAULT_SIZE;
+    for(int i = 1; i < argc; i++){
+        string arg = argv[i];
+        if(arg == "--cache") use_cache = true;
+        else if(arg.find("--cache-dir=") == 0) {
+            use_cache = true;
+            cache_dir = arg.substr(12);
+        }
+        else if(arg.find("--cache-size=") == 0){
+            if(!AssemblyCache::parseSize(arg.substr(13), cache_size)){
+                std::cerr << "ERROR: --cache-size needs a number of bytes, optionally followed by K, M or G" << endl;
+                return 1;
+            }
+        }
+        else if(arg == "--cache-stats") cache_stats = true;
+        else if(arg == "--watch") watch_mode = true;
+        else if(arg == "--batch") batch_mode = true;
+        else if(arg.find("--jobs=") == 0){
+            if(!parseCount(arg.substr(7), jobs)){
+                std::cerr << "ERROR: --jobs needs a number" << endl;
+                return 1;
+            }
+            jobs = max(1, jobs);
+        }
+        else if(arg == "--stats") stats_format = "text";
+        else if(arg == "--stats=json") stats_format = "json";
+        else if(arg.find("--trace=") == 0) trace_file = arg.substr(8);
+        else if(arg.find("--prelude=") == 0) prelude = arg.substr(10);
+        else if(arg == "--emit-prelude") emit_prelude = true;
+        else if(arg == "-g") line_table = true;
+        else if(arg.find("--") == 0) {
+            std::cerr << "ERROR: Unknown option " << arg << endl;
+            return -1;
+        }
+        else files.push_back(arg);
+    }
+    if(cache_dir == "") cache_dir = AssemblyCache::defaultDirectory();
+    if(cache_stats){
+        std::cout << AssemblyCache(cache_dir, cache_size).statistics();
+        if(files.size() == 0) return 0;
+    }
+    if(emit_prelude) use_cache = false; // a snapshot isn't an object, the cache key couldn't tell them apart
+    Jobserver::active = Jobserver::fromEnvironment();
+    if(batch_mode){
+        if(files.size() == 0 || files.size() % 2 != 0 || watch_mode || find(files.begin(), files.end(), "-") != files.end()){
+            std::cerr << "ERROR: --batch needs pairs of named input and output files" << endl;
+            return -1;
+        }
+        AssemblyCache* cache = use_cache ? new AssemblyCache(cache_dir, cache_size) : nullptr;
+        return batch(files, jobs, cache, stats_format, prelude);
+    }
+    if (files.size() != 2) {
+        std::cerr << "ERROR: Number of given parameters must be 3.\n" << endl;
         return -1;
     }
-    Assembler* assembler = new Assembler(argv[1], argv[2]);
-    assembler->start();
-    return 0;
-}
\ No newline at end of file
+
+    bool pipe = files[0] == "-" || files[1] == "-";
+    if(pipe && watch_mode){
+        std::cerr << "ERROR: --watch needs named input and output files" << endl;
+        return -1;
+    }
+    if(pipe){
+        use_cache = false; // stdin can't be hashed and read again, so pipes are never cached
+        ios::sync_with_stdio(false); // only iostreams are used, let cin/cout buffer on their own
+    }
+    AssemblyCache* cache = use_cache ? new AssemblyCache(cache_dir, cache_size) : nullptr;
+    if(watch_mode) return watch(files[0], files[1], cache, stats_format, trace_file, prelude);
+    return assemble(files[0], files[1], cache, stats_format, trace_file, prelude) == 0 ? 0 : 1; // no .end or unreadable input, errors abort
+}
@@ -0,0 +1,12 @@
+# .byte of a symbol defined later is backpatched one byte wide, R_386_8 relocations
+# expected: #data 0104030809 (fwd = 4, last+7 = 8), #tail 01 (last = 1)
+.section data
+.byte 1, fwd, 3
+.byte last+7
+fwd: .byte 9
+
+.section tail
+.byte last
+last:
+
+.end
@@ -0,0 +1,37 @@
+# one source for all variants: .equ VARIANT, 1 gives the same object as
+# keeping only the lines under VARIANT == 1 and DEBUG
+.equ VARIANT, 1
+.equ DEBUG, 1
+.global main
+
+.macro trace value
+.ifdef DEBUG
+mov $\value, %r5
+.endif
+.endm
+
+.section text
+main:
+.if VARIANT == 0
+mov $0, %r0
+.else
+.if VARIANT - 1
+mov $2, %r0
+this line is not even valid assembly, but it is never lexed
+.else
+mov $1, %r0
+.endif
+.endif
+trace 7
+.ifndef DEBUG
+.if UNDEFINED_SYMBOL
+mov $9, %r1
+.endif
+.endif
+.if VARIANT >= 1
+label1: .ifndef NOT_DEFINED
+mov $0x10, %r2
+.endif
+.endif
+halt
+.end
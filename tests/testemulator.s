@@ -0,0 +1,41 @@
+# emulator/emulator tests/testemulator.o --entry=main
+# expected: r0=0x0005, r1=0x0037 (sum 1..10), r2=0x0078 (5!), r3=0x0010, r4=0x0003, r5=0x0002 (jumps through %r7)
+.global main
+.section text
+main: mov $0, %r1
+mov $10, %r0
+sum: add %r0, %r1
+sub $1, %r0
+jne sum
+push $5
+call fact
+pop %r0
+mov %r2, result
+mov $1, %r3
+shl $4, %r3
+mov $12, %r4
+shr %r4, $2
+cmp $0x10, %r3
+jeq done
+mov $0xFFFF, %r4
+# writes to %r7 are jumps
+done: mov $by_mov, %r7
+halt
+by_mov: mov $1, %r5
+push $by_pop
+pop %r7
+halt
+by_pop: add $1, %r5
+halt
+# r2 = factorial of the word pushed by the caller
+fact: mov 2(%r6), %r0
+mov $1, %r2
+loop: cmp $1, %r0
+jgt next
+ret
+next: mul %r0, %r2
+sub $1, %r0
+jmp loop
+.section data
+result: .word 0
+.end
@@ -0,0 +1,24 @@
+# instruction encoding, bytes of each instruction in the comments
+# expected: #text 0008102c6efeff2c6efeff2c6e1c00646efdff22646efbff940000641400009400004c942b004c9400000000, #data 00002b00
+# expected relocations in text: 5 PC16 far, 9 PC16 glob, 17 PC16 far, 22 PC16 far, 25 16 data, 29 16 far, 32 16 data, 36 16 text, 40 16 glob
+.global glob
+.extern far
+.section text
+halt                # 00, no operands is still one byte
+iret                # 08
+ret                 # 10
+jmp *far(%r7)       # 2c 6e feff, the field holds -2, from the field to the end of the instruction
+jmp *glob(%r7)      # 2c 6e feff, a global in the same section keeps its PC16 relocation
+jmp *loc(%r7)       # 2c 6e 1c00, a local in the same section needs none
+mov far(%r7), %r1   # 64 6e fdff 22, -3: the register operand follows the field
+mov far(%r7), val   # 64 6e fbff 94 0000, -5: a memory operand follows, its relocation is at its own field
+mov $far, val       # 64 14 0000 94 0000, the immediate symbol counts for the second field offset
+push loc            # 4c 94 2b00, memory operands hold the address, not address-2
+push glob           # 4c 94 0000, globals are relocated by their own address
+glob: halt
+loc: halt
+
+.section data
+val: .word glob, loc  # 0000 2b00
+
+.end
@@ -0,0 +1,35 @@
+# expressions in .equ, .if, .word/.byte and instruction operands
+.global start
+.extern ext
+
+.equ SIZE, (4+4)*2          # 16
+.equ MASK, ~0xF & 0xFF       # 0xF0
+.equ SHIFTED, 1<<4|3         # 0x13
+.equ LATE, after-table+2     # table and after are defined later, resolved at .end
+.equ NEAR, ext+SIZE/4        # relocatable, refers to ext
+.equ WRAP, -32768*65536/-1   # overflows int, wraps to -32768*65536 (0 in 16 bits) instead of trapping
+
+.if SIZE*2 == 32 && MASK != 0
+.section text
+start:
+    mov $SIZE-1, %r1
+    mov $table+4, %r2
+    mov table+2, %r3
+    mov table-2(%r3), %r4
+    add $(SIZE%5)<<1, %r4
+    jmp *table+4(%pc)
+    call start+1
+    mov $ext+2, %r5
+    mov %r1, after-2
+    halt
+.else
+.section broken
+.endif
+
+.section data
+table:
+    .word 1, 2, table+2, ext-1, SIZE*4
+    .byte -1, MASK>>4, 'a'+1
+after:
+    .word after-table, LATE
+.end
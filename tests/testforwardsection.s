@@ -0,0 +1,14 @@
+# a symbol used before its definition has no section until it is defined, its relocation
+# names the section it ends up in, even when an extern is called like a truncated section name
+# expected relocations in text: 2 R_386_16 data, 6 R_386_16 text, 10 R_386_16 ext
+.extern ext
+.section text
+push val            # 4c 94 0000, relocated by data
+push loc            # 4c 94 0c00, relocated by text
+push ext            # 4c 94 0000
+loc: halt
+
+.section data
+val: .word 1
+
+.end
@@ -0,0 +1,15 @@
+# linker/linker --gc-sections -o linked.o tests/testlinkmain.o tests/testlinklib.o tests/testgcsections.o
+# removes 3 unused sections, 10 bytes: data of testlinkmain, unused and scratch; table stays through lookup, missing is not an extern of linked.o
+# with --entry=main lookup and table go too: 5 sections, 18 bytes
+.global lookup
+.extern missing
+.section lookup
+lookup: mov table, %r0
+ret
+.section unused
+call missing
+.section scratch
+.word 1, 2
+.section table
+table: .word 7
+.end
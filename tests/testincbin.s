@@ -0,0 +1,13 @@
+.global table
+
+.section data
+table: .byte 1, 2, 0x3, 0b100, 05, -6
+.word 0x1234, -1, 0777, 65535
+header: .incbin "testincbin.s", 0, 14 # first line of this file
+.word table, header
+
+.section text
+mov header, %r1
+halt
+
+.end
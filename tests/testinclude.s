@@ -0,0 +1,15 @@
+# names are looked up next to this file first, then in the working directory
+.include "testinclude.inc"
+.include "../tests/testinclude.inc"
+
+.section text
+start: load_io %r1
+load_io %r2, 2
+mov $STACK_WORDS*2, %r3
+halt
+
+.section data
+stack: .skip 8
+.word STACK_WORDS
+
+.end
@@ -0,0 +1,15 @@
+# r1 = 1 + ... + r0, stored in total, counts calls in count
+.global sum, total, count
+.section text
+sum: mov $0, %r1
+next: add %r0, %r1
+sub $1, %r0
+jne next
+mov %r1, total
+add $1, count
+add $1, count(%pc)
+ret
+.section data
+total: .word 0
+count: .word 0
+.end
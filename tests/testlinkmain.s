@@ -0,0 +1,13 @@
+# linker/linker -o linked.o tests/testlinkmain.o tests/testlinklib.o
+# emulator/emulator --entry=main linked.o: r1=0x0037, r2=0x0037, r3=0x0002
+.global main
+.extern sum, total, count
+.section text
+main: mov $10, %r0
+call sum
+mov total, %r2
+mov count(%pc), %r3
+halt
+.section data
+local: .word 0
+.end
@@ -0,0 +1,27 @@
+.global main
+
+# push a register and store it into the new frame
+.macro save reg, off=2
+push \reg
+mov \reg, \off(%r6)
+.endm
+
+.macro copy src, dst, n=2
+.rept \n
+mov \src, \dst
+.endr
+loop\@: jmp loop\@
+.endm
+
+.section text
+main: save %r1
+save %r2, 4
+copy %r1, %r3
+copy %r2, %r4, 3
+
+.section data
+.rept 4
+.word 0x1234
+.endr
+
+.end
@@ -0,0 +1,20 @@
+# uninitialized sections only record their size, read-only data can't be executed
+.global buffer, start
+
+.section text, "x"
+start: mov $5, buffer
+mov count, %r1
+halt
+
+.section rodata, ""
+count: .word 3
+
+.section bss, "w", @nobits
+buffer: .skip 512
+stack: .skip 1024
+stack_top:
+
+.section .text # the dot is optional, this reopens text with its flags
+halt
+
+.end
@@ -0,0 +1,8 @@
+# ./main --emit-prelude tests/testprelude.s prelude.bin
+# ./main --prelude=prelude.bin <input_file> <output_file>
+.extern putc, getc
+.equ TERM_OUT, 0xFF00
+.equ TERM_IN, TERM_OUT+2
+.equ TIMER_CFG, TIMER_BASE+0x10
+.equ TIMER_BASE, 0xFF10
+.end